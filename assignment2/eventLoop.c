@@ -0,0 +1,221 @@
+// Single threaded engine for the flow scheduler.
+//
+// Instead of a thread per flow sleeping until its arrival and through its transmission, every flow is a small
+// state machine (arriving, waiting, transmitting, finished) driven from one loop. Each flow has at most one
+// pending event, its arrival or the end of its transmission. Arrivals wait in one timer heap and completions,
+// at most one per channel, in another, both ordered by time. The loop sleeps until the earliest event is due,
+// handles every event that is due, and then puts the best waiting flows on whichever of the numberOfChannels
+// links are free. Waiting flows are kept in a heap ordered by the scheduling policy; with the default policy
+// that is compareFlows, so the order flows are sent in is the same as the threaded scheduler's.
+//
+// Flows are read from the input file as the simulation goes instead of all at the start, and freed once they
+// finish, so memory depends on how many flows are around at once rather than on the size of the trace. Flows in
+// the file don't have to be in arrival order: the loop keeps a window of flows read ahead in the arrival heap, so
+// a flow can appear up to that many lines after flows that arrive later than it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "eventLoop.h"
+#include "policy.h"
+#include "flowReader.h"
+
+void runEventLoop(flowReader *reader, int window)
+{
+	heap *arrivals = createHeap(window, compareEvents);
+	heap *completions = createHeap(numberOfChannels, compareEvents);
+	heap *waitingFlows = createHeap(window, schedulingPolicy->compare);
+	heap *timers;
+
+	readArrivals(reader, arrivals, window, 0);
+
+	while ((timers = nextTimers(arrivals, completions)) != NULL)
+	{
+		flowPointer nextEvent = (flowPointer) heapPeek(timers);
+		waitUntil(nextEvent->eventTime);
+
+		// Handle everything that is due before choosing who transmits, so flows that arrive together compete fairly
+		double now = getElapsedTime();
+		while ((timers = nextTimers(arrivals, completions)) != NULL && ((flowPointer) heapPeek(timers))->eventTime <= now)
+		{
+			nextEvent = (flowPointer) heapPop(timers);
+			if (nextEvent->eventType == EVENT_ARRIVAL)
+			{
+				readArrivals(reader, arrivals, window, now);
+				logArrival(nextEvent, now);
+				nextEvent->state = FLOW_WAITING;
+				nextEvent->remainingTime = nextEvent->transmissionTime;
+				if (schedulingPolicy->arrive != NULL)
+				{
+					schedulingPolicy->arrive(nextEvent);
+				}
+				heapPush(waitingFlows, nextEvent);
+				flowPointer busyFlow = nextToFinish();
+				if (busyFlow != NULL)
+				{
+					logWait(nextEvent, busyFlow);
+				}
+			}
+			else
+			{
+				logFinish(nextEvent, now);
+				nextEvent->state = FLOW_FINISHED;
+				nextEvent->remainingTime = 0;
+				transmittingFlows[nextEvent->channel] = NULL;
+				channelBusyTime[nextEvent->channel] += now - nextEvent->startTime;
+				free(nextEvent);
+			}
+		}
+
+		while (heapPeek(waitingFlows) != NULL)
+		{
+			int channel = findFreeChannel();
+			if (channel == -1 && schedulingPolicy->preemptive)
+			{
+				channel = preemptChannel(completions, waitingFlows, now);
+			}
+			if (channel == -1)
+			{
+				break;
+			}
+
+			flowPointer flowToTransmit = (flowPointer) heapPop(waitingFlows);
+			flowToTransmit->state = FLOW_TRANSMITTING;
+			flowToTransmit->channel = channel;
+			flowToTransmit->startTime = now;
+			transmittingFlows[channel] = flowToTransmit;
+			if (schedulingPolicy->dispatch != NULL)
+			{
+				schedulingPolicy->dispatch(flowToTransmit);
+			}
+			logStart(flowToTransmit, now);
+			scheduleEvent(completions, flowToTransmit, now + flowToTransmit->remainingTime, EVENT_COMPLETION);
+		}
+	}
+
+	freeHeap(arrivals);
+	freeHeap(completions);
+	freeHeap(waitingFlows);
+}
+
+// Reads flows from the input file until there are window of them waiting to arrive. A flow that should already have
+// arrived by now came too far out of order for the window, so it arrives now instead.
+void readArrivals(flowReader *reader, heap *arrivals, int window, double now)
+{
+	static int warned = 0;
+	flowPointer flowInfo;
+
+	while (arrivals->size < window && (flowInfo = readFlow(reader)) != NULL)
+	{
+		flowInfo->state = FLOW_ARRIVING;
+		if (flowInfo->arrivalTime < now)
+		{
+			if (!warned)
+			{
+				fprintf(stderr, "Flow %d is too far out of order in the input file, so it arrives late. Try a bigger -w.\n", flowInfo->flowNumber);
+				warned = 1;
+			}
+			scheduleEvent(arrivals, flowInfo, now, EVENT_ARRIVAL);
+		}
+		else
+		{
+			scheduleEvent(arrivals, flowInfo, flowInfo->arrivalTime, EVENT_ARRIVAL);
+		}
+	}
+}
+
+// Returns whichever of the two timer heaps has the next event, or NULL if both are empty.
+heap *nextTimers(heap *arrivals, heap *completions)
+{
+	if (heapPeek(completions) == NULL)
+	{
+		return heapPeek(arrivals) != NULL ? arrivals : NULL;
+	}
+	if (heapPeek(arrivals) == NULL || compareEvents(heapPeek(completions), heapPeek(arrivals)) == -1)
+	{
+		return completions;
+	}
+	return arrivals;
+}
+
+// If the best waiting flow comes out before one of the transmitting flows, stops the transmitting flow that comes out
+// last, puts it back in waitingFlows with what it has left to send and returns its channel. Returns -1 otherwise.
+int preemptChannel(heap *completions, heap *waitingFlows, double now)
+{
+	int i;
+	flowPointer lastFlow = NULL;
+
+	for (i = 0; i < numberOfChannels; i ++)
+	{
+		flowPointer flowInfo = transmittingFlows[i];
+		flowInfo->remainingTime = flowInfo->eventTime - now;
+		if (lastFlow == NULL || schedulingPolicy->compare(lastFlow, flowInfo) == -1)
+		{
+			lastFlow = flowInfo;
+		}
+	}
+
+	flowPointer bestFlow = (flowPointer) heapPeek(waitingFlows);
+	if (schedulingPolicy->compare(bestFlow, lastFlow) != -1)
+	{
+		return -1;
+	}
+
+	logPreempt(lastFlow, bestFlow, now);
+	heapRemove(completions, lastFlow);
+	channelBusyTime[lastFlow->channel] += now - lastFlow->startTime;
+	transmittingFlows[lastFlow->channel] = NULL;
+	lastFlow->state = FLOW_WAITING;
+	heapPush(waitingFlows, lastFlow);
+
+	return lastFlow->channel;
+}
+
+/* Return values:
+-1 if flowA's event is due before flowB's
++1 otherwise
+Completions come before arrivals at the same time, then events go in the order they were scheduled. */
+int compareEvents(void *pointerA, void *pointerB)
+{
+	flowPointer flowA = (flowPointer) pointerA;
+	flowPointer flowB = (flowPointer) pointerB;
+
+	if (flowA->eventTime < flowB->eventTime) return -1;
+	else if (flowA->eventTime > flowB->eventTime) return 1;
+	else
+		if (flowA->eventType < flowB->eventType) return -1;
+		else if (flowA->eventType > flowB->eventType) return 1;
+		else
+			if (flowA->eventSequence < flowB->eventSequence) return -1;
+			else return 1;
+}
+
+void scheduleEvent(heap *timers, flowPointer flowInfo, double time, int type)
+{
+	static long nextSequence = 0;
+
+	flowInfo->eventTime = time;
+	flowInfo->eventType = type;
+	flowInfo->eventSequence = nextSequence ++;
+	heapPush(timers, flowInfo);
+}
+
+// Sleeps until time seconds into the simulation. On the simulated clock there is nothing to wait for, the clock just
+// moves forward to time.
+void waitUntil(double time)
+{
+	if (useVirtualClock)
+	{
+		if (time > virtualTime)
+		{
+			virtualTime = time;
+		}
+		return;
+	}
+
+	double remaining = time - getElapsedTime();
+	if (remaining > 0)
+	{
+		usleep(remaining * 1000000);
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef EVENTLOOP_H_INCLUDED
+#define EVENTLOOP_H_INCLUDED
+
+#include "mfs.h"
+#include "heap.h"
+#include "flowReader.h"
+
+void runEventLoop(flowReader *reader, int window);
+void readArrivals(flowReader *reader, heap *arrivals, int window, double now);
+heap *nextTimers(heap *arrivals, heap *completions);
+int preemptChannel(heap *completions, heap *waitingFlows, double now);
+int compareEvents(void *flowA, void *flowB);
+void scheduleEvent(heap *timers, flowPointer flowInfo, double time, int type);
+void waitUntil(double time);
+
+#endif
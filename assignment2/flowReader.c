@@ -0,0 +1,188 @@
+// Input file reader for MFS.
+//
+// The file is mapped rather than read, and flows are parsed out of it by hand instead of with fscanf, which spends
+// most of its time on format strings and locale handling. Each readFlow call parses one "number:arrival,transmission,
+// priority" line into a new flow, so the event loop can keep just the flows that haven't finished yet in memory.
+// Every so often the pages already parsed are handed back to the kernel so a huge trace doesn't stay resident.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flowReader.h"
+
+#define RELEASE_BYTES (64 * 1024 * 1024)
+
+flowReader *openFlowReader(char *fileName)
+{
+	struct stat fileInfo;
+	int fileDescriptor = open(fileName, O_RDONLY);
+
+	if (fileDescriptor == -1 || fstat(fileDescriptor, &fileInfo) == -1)
+	{
+		fprintf(stderr, "Can't open input file!\n");
+		exit(1);
+	}
+
+	flowReader *reader = calloc(1, sizeof(flowReader));
+	reader->size = fileInfo.st_size;
+	reader->line = 1;
+	if (reader->size > 0)
+	{
+		reader->data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (reader->data == MAP_FAILED)
+		{
+			fprintf(stderr, "Can't open input file!\n");
+			exit(1);
+		}
+		madvise(reader->data, reader->size, MADV_SEQUENTIAL);
+	}
+	close(fileDescriptor);
+
+	// Read the first line to find how many flows we have
+	if (!parseInteger(reader, &reader->numberOfFlows) || reader->numberOfFlows < 0)
+	{
+		fprintf(stderr, "Couldn't get the total number of flows from input file! Is it formatted correctly?\n");
+		exit(1);
+	}
+
+	return reader;
+}
+
+// Returns the next flow in the file, or NULL once the file or the number of flows it promised runs out.
+flowPointer readFlow(flowReader *reader)
+{
+	int flowNumber;
+	int priority;
+	double arrivalTime;
+	double transmissionTime;
+
+	if (reader->flowsRead == reader->numberOfFlows)
+	{
+		return NULL;
+	}
+
+	skipSpace(reader);
+	if (reader->position == reader->size)
+	{
+		return NULL;
+	}
+	if (!parseInteger(reader, &flowNumber) || !expectCharacter(reader, ':') ||
+		!parseNumber(reader, &arrivalTime) || !expectCharacter(reader, ',') ||
+		!parseNumber(reader, &transmissionTime) || !expectCharacter(reader, ',') ||
+		!parseInteger(reader, &priority))
+	{
+		fprintf(stderr, "Line %d of the input file isn't a flow, ignoring the rest of the file.\n", reader->line);
+		reader->numberOfFlows = reader->flowsRead;
+		return NULL;
+	}
+
+	flowPointer flowInfo = calloc(1, sizeof(flow));
+	flowInfo->flowNumber = flowNumber;
+	flowInfo->index = reader->flowsRead ++;
+	flowInfo->priority = priority;
+
+	// Put the times in seconds
+	flowInfo->arrivalTime = (float) arrivalTime / 10;
+	flowInfo->transmissionTime = (float) transmissionTime / 10;
+
+	// Initialize its condition variable
+	pthread_cond_init(&flowInfo->readyToTransmitCondVar, NULL);
+
+	if (reader->position - reader->released >= RELEASE_BYTES)
+	{
+		size_t pageSize = sysconf(_SC_PAGESIZE);
+		size_t end = (reader->position / pageSize) * pageSize;
+		madvise(reader->data + reader->released, end - reader->released, MADV_DONTNEED);
+		reader->released = end;
+	}
+
+	return flowInfo;
+}
+
+void closeFlowReader(flowReader *reader)
+{
+	if (reader->size > 0)
+	{
+		munmap(reader->data, reader->size);
+	}
+	free(reader);
+}
+
+void skipSpace(flowReader *reader)
+{
+	while (reader->position < reader->size)
+	{
+		char c = reader->data[reader->position];
+		if (c == '\n')
+		{
+			reader->line ++;
+		}
+		else if (c != ' ' && c != '\t' && c != '\r')
+		{
+			break;
+		}
+		reader->position ++;
+	}
+}
+
+int parseInteger(flowReader *reader, int *value)
+{
+	double number;
+	if (!parseNumber(reader, &number) || number != (int) number)
+	{
+		return 0;
+	}
+	*value = (int) number;
+	return 1;
+}
+
+// Parses an optionally signed decimal number like 12 or 1.5. Returns 0 if there isn't one.
+int parseNumber(flowReader *reader, double *value)
+{
+	int negative = 0;
+	int digits = 0;
+	double number = 0;
+	double scale = 1;
+
+	skipSpace(reader);
+	if (reader->position < reader->size && (reader->data[reader->position] == '-' || reader->data[reader->position] == '+'))
+	{
+		negative = (reader->data[reader->position ++] == '-');
+	}
+	while (reader->position < reader->size && reader->data[reader->position] >= '0' && reader->data[reader->position] <= '9')
+	{
+		number = (number * 10) + (reader->data[reader->position ++] - '0');
+		digits ++;
+	}
+	if (reader->position < reader->size && reader->data[reader->position] == '.')
+	{
+		reader->position ++;
+		while (reader->position < reader->size && reader->data[reader->position] >= '0' && reader->data[reader->position] <= '9')
+		{
+			number = (number * 10) + (reader->data[reader->position ++] - '0');
+			scale *= 10;
+			digits ++;
+		}
+	}
+	if (digits == 0)
+	{
+		return 0;
+	}
+
+	*value = (negative ? -number : number) / scale;
+	return 1;
+}
+
+int expectCharacter(flowReader *reader, char c)
+{
+	skipSpace(reader);
+	if (reader->position < reader->size && reader->data[reader->position] == c)
+	{
+		reader->position ++;
+		return 1;
+	}
+	return 0;
+}
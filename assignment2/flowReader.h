@@ -0,0 +1,26 @@
+#ifndef FLOWREADER_H_INCLUDED
+#define FLOWREADER_H_INCLUDED
+
+#include <stddef.h>
+#include "mfs.h"
+
+// Reads flows one at a time out of an input file mapped into memory, so a trace never has to fit in memory as flows.
+typedef struct {
+	char *data;
+	size_t size;
+	size_t position;
+	size_t released; // Everything before this has been handed back to the kernel
+	int numberOfFlows; // From the first line of the file
+	int flowsRead;
+	int line;
+} flowReader;
+
+flowReader *openFlowReader(char *fileName);
+flowPointer readFlow(flowReader *reader);
+void closeFlowReader(flowReader *reader);
+void skipSpace(flowReader *reader);
+int parseInteger(flowReader *reader, int *value);
+int parseNumber(flowReader *reader, double *value);
+int expectCharacter(flowReader *reader, char c);
+
+#endif
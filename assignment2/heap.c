@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include "heap.h"
+
+heap *createHeap(int capacity, int (*compare)(void *itemA, void *itemB))
+{
+	heap *h = malloc(sizeof(heap));
+	h->capacity = capacity > 0 ? capacity : 16;
+	h->items = malloc(h->capacity * sizeof(void *));
+	h->size = 0;
+	h->compare = compare;
+	return h;
+}
+
+void freeHeap(heap *h)
+{
+	free(h->items);
+	free(h);
+}
+
+// Moves item up from slot i until its parent comes out before it.
+static void siftUp(heap *h, int i, void *item)
+{
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if (h->compare(h->items[parent], item) == -1)
+		{
+			break;
+		}
+		h->items[i] = h->items[parent];
+		i = parent;
+	}
+	h->items[i] = item;
+}
+
+// Moves item down from slot i until both children come out after it. Returns where it ends up.
+static int siftDown(heap *h, int i, void *item)
+{
+	while (1)
+	{
+		int child = (2 * i) + 1;
+		if (child >= h->size)
+		{
+			break;
+		}
+		if (child + 1 < h->size && h->compare(h->items[child + 1], h->items[child]) == -1)
+		{
+			child ++;
+		}
+		if (h->compare(item, h->items[child]) == -1)
+		{
+			break;
+		}
+		h->items[i] = h->items[child];
+		i = child;
+	}
+	h->items[i] = item;
+	return i;
+}
+
+void heapPush(heap *h, void *item)
+{
+	if (h->size == h->capacity)
+	{
+		h->capacity *= 2;
+		h->items = realloc(h->items, h->capacity * sizeof(void *));
+	}
+
+	siftUp(h, h->size ++, item);
+}
+
+// Removes and returns the item that comes out first, or NULL if the heap is empty.
+void *heapPop(heap *h)
+{
+	if (h->size == 0)
+	{
+		return NULL;
+	}
+
+	void *top = h->items[0];
+	void *last = h->items[-- h->size];
+	if (h->size > 0)
+	{
+		siftDown(h, 0, last);
+	}
+
+	return top;
+}
+
+void *heapPeek(heap *h)
+{
+	return h->size > 0 ? h->items[0] : NULL;
+}
+
+// Removes item from anywhere in the heap. This has to search for it, so keep it to small heaps.
+void heapRemove(heap *h, void *item)
+{
+	int i;
+	for (i = 0; i < h->size; i ++)
+	{
+		if (h->items[i] == item)
+		{
+			break;
+		}
+	}
+	if (i == h->size)
+	{
+		return;
+	}
+
+	// Fill the hole with the last item, which may belong further up or further down
+	void *last = h->items[-- h->size];
+	if (i < h->size && siftDown(h, i, last) == i)
+	{
+		siftUp(h, i, last);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef HEAP_H_INCLUDED
+#define HEAP_H_INCLUDED
+
+// Binary min heap of pointers. compare works like compareFlows: -1 if itemA should come out before itemB, +1 otherwise.
+typedef struct {
+	void **items;
+	int size;
+	int capacity;
+	int (*compare)(void *itemA, void *itemB);
+} heap;
+
+heap *createHeap(int capacity, int (*compare)(void *itemA, void *itemB));
+void freeHeap(heap *h);
+void heapPush(heap *h, void *item);
+void *heapPop(heap *h);
+void *heapPeek(heap *h);
+void heapRemove(heap *h, void *item);
+
+#endif
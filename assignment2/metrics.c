@@ -0,0 +1,181 @@
+// Per flow latency metrics for MFS -m.
+//
+// Both engines fill in a flow's record through the log functions as it arrives, starts, is preempted and finishes.
+// The record travels with the flow until it finishes and is then appended to metrics, which grows as needed, so
+// nothing is sized from the flow count in the input file. The percentiles need every finished flow's times, so -m
+// still costs one record per flow by the end of the run. At the end the flows are grouped by priority class and for
+// each class the wait (time spent queued), service (time spent transmitting) and sojourn (arrival to finish) times
+// are summarized along with the class's throughput and share of the link.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "metrics.h"
+
+flowMetrics *metrics = NULL;
+int numberOfMetrics = 0;
+int metricsCapacity = 0;
+pthread_mutex_t metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Scratch space printMetrics sorts each class's times in
+double *waits;
+double *services;
+double *sojourns;
+
+void createMetrics()
+{
+	metricsCapacity = 1024;
+	numberOfMetrics = 0;
+	metrics = malloc(metricsCapacity * sizeof(flowMetrics));
+}
+
+void freeMetrics()
+{
+	free(metrics);
+	metrics = NULL;
+	numberOfMetrics = 0;
+	metricsCapacity = 0;
+}
+
+void recordArrival(flowPointer flowInfo, double time)
+{
+	flowMetrics *record = &flowInfo->record;
+	record->priority = flowInfo->priority;
+	record->arrivalTime = time;
+	record->startTime = -1;
+	record->serviceTime = 0;
+}
+
+void recordStart(flowPointer flowInfo, double time)
+{
+	flowMetrics *record = &flowInfo->record;
+	if (record->startTime < 0)
+	{
+		record->startTime = time;
+	}
+	record->lastStartTime = time;
+}
+
+// The flow has stopped transmitting, whether it finished or was preempted.
+void recordStop(flowPointer flowInfo, double time)
+{
+	flowMetrics *record = &flowInfo->record;
+	record->serviceTime += time - record->lastStartTime;
+}
+
+// Flows on different channels of the threaded engine can finish at the same time, so appending takes a lock.
+void recordFinish(flowPointer flowInfo, double time)
+{
+	recordStop(flowInfo, time);
+	flowInfo->record.finishTime = time;
+
+	pthread_mutex_lock(&metricsMutex);
+	if (numberOfMetrics == metricsCapacity)
+	{
+		metricsCapacity *= 2;
+		metrics = realloc(metrics, metricsCapacity * sizeof(flowMetrics));
+	}
+	metrics[numberOfMetrics ++] = flowInfo->record;
+	pthread_mutex_unlock(&metricsMutex);
+}
+
+void printMetrics(double totalTime)
+{
+	int i;
+	int first;
+	int last;
+	char title[32];
+	int *order = malloc((numberOfMetrics + 1) * sizeof(int));
+
+	waits = malloc((numberOfMetrics + 1) * sizeof(double));
+	services = malloc((numberOfMetrics + 1) * sizeof(double));
+	sojourns = malloc((numberOfMetrics + 1) * sizeof(double));
+
+	// Group the flows by priority class, then summarize each class and finally all of them together
+	for (i = 0; i < numberOfMetrics; i ++)
+	{
+		order[i] = i;
+	}
+	qsort(order, numberOfMetrics, sizeof(int), compareMetricsByPriority);
+
+	for (first = 0; first < numberOfMetrics; first = last)
+	{
+		last = first;
+		while (last < numberOfMetrics && metrics[order[last]].priority == metrics[order[first]].priority)
+		{
+			last ++;
+		}
+		snprintf(title, sizeof(title), "Priority %d", metrics[order[first]].priority);
+		summarizeFlows(title, order + first, last - first, totalTime);
+	}
+	summarizeFlows("All flows", order, numberOfMetrics, totalTime);
+
+	free(order);
+	free(waits);
+	free(services);
+	free(sojourns);
+}
+
+// Prints the throughput, utilization and time distributions of the count flows whose metrics are at indices.
+void summarizeFlows(char *title, int *indices, int count, double totalTime)
+{
+	int i;
+	double serviceTotal = 0;
+
+	for (i = 0; i < count; i ++)
+	{
+		flowMetrics *record = &metrics[indices[i]];
+		sojourns[i] = record->finishTime - record->arrivalTime;
+		services[i] = record->serviceTime;
+		waits[i] = sojourns[i] - services[i];
+		serviceTotal += services[i];
+	}
+
+	printf("METRICS: %s: %d flows, throughput %.2f flows/s, utilization %.1f%%.\n", title, count,
+		totalTime > 0 ? count / totalTime : 0, totalTime > 0 ? 100 * serviceTotal / (totalTime * numberOfChannels) : 0);
+	printDistribution("wait", waits, count);
+	printDistribution("service", services, count);
+	printDistribution("sojourn", sojourns, count);
+}
+
+// Sorts values and prints their mean, nearest rank percentiles and maximum.
+void printDistribution(char *name, double *values, int count)
+{
+	int i;
+	double sum = 0;
+
+	if (count == 0)
+	{
+		return;
+	}
+
+	qsort(values, count, sizeof(double), compareDoubles);
+	for (i = 0; i < count; i ++)
+	{
+		sum += values[i];
+	}
+
+	printf("METRICS:     %-7s mean %.2f, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f\n", name, sum / count,
+		values[(int) ceil(0.50 * count) - 1], values[(int) ceil(0.95 * count) - 1],
+		values[(int) ceil(0.99 * count) - 1], values[count - 1]);
+}
+
+int compareDoubles(const void *valueA, const void *valueB)
+{
+	double a = *(const double *) valueA;
+	double b = *(const double *) valueB;
+
+	if (a < b) return -1;
+	else if (a > b) return 1;
+	else return 0;
+}
+
+int compareMetricsByPriority(const void *indexA, const void *indexB)
+{
+	int priorityA = metrics[*(const int *) indexA].priority;
+	int priorityB = metrics[*(const int *) indexB].priority;
+
+	if (priorityA < priorityB) return -1;
+	else if (priorityA > priorityB) return 1;
+	else return *(const int *) indexA - *(const int *) indexB;
+}
@@ -0,0 +1,21 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include "mfs.h"
+
+extern flowMetrics *metrics;
+extern int numberOfMetrics;
+
+void createMetrics();
+void freeMetrics();
+void recordArrival(flowPointer flowInfo, double time);
+void recordStart(flowPointer flowInfo, double time);
+void recordStop(flowPointer flowInfo, double time);
+void recordFinish(flowPointer flowInfo, double time);
+void printMetrics(double totalTime);
+void summarizeFlows(char *title, int *indices, int count, double totalTime);
+void printDistribution(char *name, double *values, int count);
+int compareDoubles(const void *valueA, const void *valueB);
+int compareMetricsByPriority(const void *indexA, const void *indexB);
+
+#endif
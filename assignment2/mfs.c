@@ -4,62 +4,151 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include "mfs.h"
-
-typedef struct {
-	int flowNumber;
-	float arrivalTime;
-	float transmissionTime;
-	int priority;
-	pthread_t threadId;
-	pthread_cond_t readyToTransmitCondVar;
-} flow;
-
-typedef flow * flowPointer;
+#include "eventLoop.h"
+#include "heap.h"
+#include "policy.h"
+#include "metrics.h"
+#include "flowReader.h"
+#include "queue.h"
 
 struct timeval startTime;
 
+// With -v the clock is simulated: getElapsedTime returns virtualTime, which the event loop jumps straight to each event
+int useVirtualClock = 0;
+double virtualTime = 0;
+
 int numberOfFlows;
 int remainingFlows;
 
 flowPointer *allFlows;
-flowPointer *flowQueue;
+heap *flowQueue;
 
-flowPointer currentlyTransmittingFlow;
+// Flows that have arrived but that the scheduler hasn't moved into flowQueue yet. Flows push themselves here without
+// taking any lock, so stamping an arrival never waits for the scheduler or another flow.
+queue arrivalQueue;
 
-pthread_cond_t nobodyTransmittingCondVar = PTHREAD_COND_INITIALIZER;
-pthread_cond_t somebodyTransmittingCondVar = PTHREAD_COND_INITIALIZER;
+// The flow on each of the numberOfChannels links, or NULL if it is free, and how long each has spent transmitting
+int numberOfChannels = 1;
+flowPointer *transmittingFlows;
+double *channelBusyTime;
+
+// The scheduler sleeps on schedulerCondVar until a flow arrives or finishes, and each waiting flow sleeps on its own
+// readyToTransmitCondVar until the scheduler picks it. All of them are used with flowQueueMutex.
+pthread_cond_t schedulerCondVar = PTHREAD_COND_INITIALIZER;
 
-pthread_mutex_t remainingFlowsMutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t flowQueueMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 int main(int argc, char *argv[])
 {
 	int i;
+	int useEventLoop = 0;
+	int printFlowMetrics = 0;
+	int window = 4096;
+	int option;
 	
 	// Keep track of when the simulation starts
 	gettimeofday(&startTime, NULL);
 	
-	if(argc != 2)
+	// -e runs every flow from one event loop instead of a thread per flow, -v also replaces sleeping with a simulated clock,
+	// -k sets how many links flows can transmit on at once, -p picks the scheduling policy (only the event loop has
+	// anything but the default), -m prints latency metrics per priority class at the end, -w sets how many flows the
+	// event loop reads ahead of the clock
+	while ((option = getopt(argc, argv, "evk:p:mw:")) != -1)
+	{
+		if (option == 'e')
+		{
+			useEventLoop = 1;
+		}
+		else if (option == 'v')
+		{
+			useEventLoop = 1;
+			useVirtualClock = 1;
+		}
+		else if (option == 'k')
+		{
+			numberOfChannels = atoi(optarg);
+			if (numberOfChannels < 1)
+			{
+				argc = 0;
+			}
+		}
+		else if (option == 'w')
+		{
+			window = atoi(optarg);
+			if (window < 1)
+			{
+				argc = 0;
+			}
+		}
+		else if (option == 'm')
+		{
+			printFlowMetrics = 1;
+		}
+		else if (option == 'p')
+		{
+			schedulingPolicy = findPolicy(optarg);
+			if (schedulingPolicy == NULL)
+			{
+				fprintf(stderr, "Unknown policy %s! Use priority, preemptive, srtf or wfq.\n", optarg);
+				return -1;
+			}
+			if (schedulingPolicy != &policies[0])
+			{
+				useEventLoop = 1;
+			}
+		}
+		else
+		{
+			argc = 0;
+		}
+	}
+	
+	if(argc - optind != 1)
 	{
-		fprintf(stderr, "Usage: MFS <input file>\n");
+		fprintf(stderr, "Usage: MFS [-e] [-v] [-m] [-k channels] [-p policy] [-w window] <input file>\n");
 		return -1;
 	}
 	
-	// Parse input file, put all flows into allFlows, initialize remainingFlows
-	getFlows(argv[1]);
+	// Every channel starts out free
+	transmittingFlows = calloc(numberOfChannels, sizeof(flowPointer));
+	channelBusyTime = calloc(numberOfChannels, sizeof(double));
 	
-	// Create the queue for the threads to wait in. Set the default queue values to an empty flow, i.e., flowNumber = 0.
-	flowQueue = malloc(numberOfFlows * sizeof(flowPointer));
-	flow emptyFlow;
-	emptyFlow.flowNumber = 0;
-	for (i = 0; i < numberOfFlows; i ++)
+	if (useEventLoop)
 	{
-		flowQueue[i] = &emptyFlow;
+		// The event loop reads the flows as it goes and frees them when they finish
+		flowReader *reader = openFlowReader(argv[optind]);
+		numberOfFlows = reader->numberOfFlows;
+		if (printFlowMetrics)
+		{
+			createMetrics();
+		}
+		runEventLoop(reader, window);
+		numberOfFlows = reader->flowsRead;
+		closeFlowReader(reader);
+		freePolicy();
+		
+		logUtilization(getElapsedTime());
+		if (printFlowMetrics)
+		{
+			printMetrics(getElapsedTime());
+			freeMetrics();
+		}
+		free(transmittingFlows);
+		free(channelBusyTime);
+		return 0;
 	}
 	
-	// Initialize the currentlyTransmittingFlow to the emptyFlow because there are no flows tranmsitting yet.
-	currentlyTransmittingFlow = &emptyFlow;
+	// Parse input file, put all flows into allFlows, initialize remainingFlows
+	getFlows(argv[optind]);
+	if (printFlowMetrics)
+	{
+		createMetrics();
+	}
+	
+	// Create the queue for the threads to wait in, ordered so the flow that should transmit next is on top.
+	flowQueue = createHeap(numberOfFlows, compareFlows);
+	initQueue(&arrivalQueue);
 	
 	// Start scheduler thread
 	pthread_t schedulerThreadId;
@@ -71,12 +160,12 @@ int main(int argc, char *argv[])
 		pthread_create(&(allFlows[i]->threadId), NULL, flowFunction, allFlows[i]);
 	}
 	
-	pthread_mutex_lock(&remainingFlowsMutex);
+	pthread_mutex_lock(&flowQueueMutex);
 	
 	// Tell the scheduler to begin
 	printf("MAIN: Telling Scheduler to begin!\n");
-	pthread_cond_signal(&nobodyTransmittingCondVar);
-	pthread_mutex_unlock(&remainingFlowsMutex);
+	pthread_cond_signal(&schedulerCondVar);
+	pthread_mutex_unlock(&flowQueueMutex);
 	
 	// Wait for all threads to finish
 	for (i = 0; i < numberOfFlows; i ++)
@@ -85,170 +174,128 @@ int main(int argc, char *argv[])
 	}
 	
 	pthread_join(schedulerThreadId, NULL);
+	logUtilization(getElapsedTime());
+	if (printFlowMetrics)
+	{
+		printMetrics(getElapsedTime());
+		freeMetrics();
+	}
 	
 	free(allFlows);
-	free(flowQueue);
+	freeHeap(flowQueue);
+	free(transmittingFlows);
+	free(channelBusyTime);
 	
 	return 0; // Success!?
 }
 
 void getFlows(char *fileName)
 {
-	FILE *inputFilePointer;
-	inputFilePointer = fopen(fileName, "r");
+	flowPointer flowInfo;
+	flowReader *reader = openFlowReader(fileName);
 	
-	if (inputFilePointer == NULL)
-	{
-		fprintf(stderr, "Can't open input file!\n");
-		exit(1);
-	}
-	
-	// Read the first line to find how many flows we have
-	if (fscanf(inputFilePointer, "%d", &numberOfFlows) != 1)
-	{
-		fprintf(stderr, "Couldn't get the total number of flows from input file! Is it formatted correctly?\n");
-		exit(1);
-	}
-	
-	allFlows = malloc(numberOfFlows * sizeof(flowPointer));
+	allFlows = malloc(reader->numberOfFlows * sizeof(flowPointer));
 	remainingFlows = 0;
-	while (!feof(inputFilePointer)) {
-		flow inputFlow;
-		
-		//allFlows[remainingFlows - 1] = malloc(sizeof(flow));
-		//flowPointer inputFlow = allFlows[remainingFlows - 1];
-		
-		if (fscanf(inputFilePointer, "%d:%f,%f,%d", &inputFlow.flowNumber, &inputFlow.arrivalTime, &inputFlow.transmissionTime, &inputFlow.priority) != 4) break;
-		//if (fscanf(inputFilePointer, "%d:%f,%f,%d", &inputFlow->flowNumber, &inputFlow->arrivalTime, &inputFlow->transmissionTime, &inputFlow->priority) != 4) break;
-		
-		// Put the times in seconds
-		inputFlow.arrivalTime /= 10;
-		inputFlow.transmissionTime /= 10;
-		//inputFlow->arrivalTime /= 10;
-		//inputFlow->transmissionTime /= 10;
-		
-		allFlows[remainingFlows] = malloc(sizeof(flow));
-		allFlows[remainingFlows]->flowNumber = inputFlow.flowNumber;
-		allFlows[remainingFlows]->arrivalTime = inputFlow.arrivalTime;
-		allFlows[remainingFlows]->transmissionTime = inputFlow.transmissionTime;
-		allFlows[remainingFlows]->priority = inputFlow.priority;
-		
-		// Initialize its condition variable
-		pthread_cond_init(&allFlows[remainingFlows]->readyToTransmitCondVar, NULL);
-		
+	while ((flowInfo = readFlow(reader)) != NULL)
+	{
+		allFlows[remainingFlows] = flowInfo;
 		remainingFlows ++;
 	}
+	numberOfFlows = remainingFlows;
 	
 	// Don't need the file anymore
-	fclose(inputFilePointer);
+	closeFlowReader(reader);
 }
 
 void *flowFunction(void *pointer)
 {
-	int i;
-	
 	flowPointer flowInfo = (flowPointer) pointer;
 	
 	// Sleep until its arrival time.
 	usleep(flowInfo->arrivalTime * 1000000);
-	printf("FLOW: Flow %d arrives: arrival time (%.2f), transmission time (%.1f), priority (%d) condvar address: %p.\n", flowInfo->flowNumber, getElapsedTime(), flowInfo->transmissionTime, flowInfo->priority, &flowInfo->readyToTransmitCondVar);
+	logArrival(flowInfo, getElapsedTime());
 	
-	// Add itself to the queue of flows waiting to transmit (mutex protected).
+	// Add itself to the arrival queue (lock free), then tell the scheduler, which moves it into the queue of flows
+	// waiting to transmit. Signalling under the mutex means the wakeup can't slip in between the scheduler finding
+	// the arrival queue empty and going to sleep.
+	queuePush(&arrivalQueue, &flowInfo->arrivalNode, flowInfo);
 	//printf("FLOW: Flow %d Trying to gain control of flowQueueMutex!\n", flowInfo->flowNumber);
 	pthread_mutex_lock(&flowQueueMutex);
 	//printf("FLOW: Flow %d Got control of flowQueueMutex!\n", flowInfo->flowNumber);
-	for (i = 0; i < numberOfFlows; i ++)
+	pthread_cond_signal(&schedulerCondVar);
+	while (flowInfo->state != FLOW_TRANSMITTING)
 	{
-		// Find the first empty spot in the queue; the end of the line. A flow with a flow number of 0 is considered empty.
-		if (flowQueue[i]->flowNumber == 0)
-		{
-			flowQueue[i] = flowInfo;
-			break;
-		}
+		pthread_cond_wait(&flowInfo->readyToTransmitCondVar, &flowQueueMutex);
 	}
 	
-	//pthread_mutex_unlock(&flowQueueMutex);
-	
-	// Check if there is already a flow transmitting
-	//printf("FLOW: Flow %d Trying to gain control of flowQueueMutex!\n", flowInfo->flowNumber);
-	//pthread_mutex_lock(&flowQueueMutex);
-	//printf("FLOW: Flow %d Got control of flowQueueMutex!\n", flowInfo->flowNumber);
-	while (currentlyTransmittingFlow->flowNumber != flowInfo->flowNumber)
-	{
-		if (currentlyTransmittingFlow->flowNumber != 0)
-		{
-			printf("FLOW: Flow %d waits for the finish of flow %d. \n", flowInfo->flowNumber, currentlyTransmittingFlow->flowNumber);
-		}
-		pthread_cond_wait(&somebodyTransmittingCondVar, &flowQueueMutex);
-	}
-
-	// Transmit
-	printf("FLOW: Flow %d starts its transmission at time %.2f.\n", flowInfo->flowNumber, getElapsedTime());
-	usleep(flowInfo->transmissionTime * 1000000);
-	printf("FLOW: Flow %d finishes its transmission at time %.2f.\n", flowInfo->flowNumber, getElapsedTime());
-	
+	// Transmit. The channel is ours until we give it back, so don't hold the mutex while other flows arrive and
+	// other channels finish.
 	pthread_mutex_unlock(&flowQueueMutex);
+	logStart(flowInfo, getElapsedTime());
+	usleep(flowInfo->transmissionTime * 1000000);
+	logFinish(flowInfo, getElapsedTime());
 	
-	pthread_mutex_lock(&remainingFlowsMutex);
 	// Signals the scheduler that another flow can transmit (condvar, w/ mutex).
-	pthread_cond_signal(&nobodyTransmittingCondVar);
-	pthread_mutex_unlock(&remainingFlowsMutex);
+	pthread_mutex_lock(&flowQueueMutex);
+	flowInfo->state = FLOW_FINISHED;
+	transmittingFlows[flowInfo->channel] = NULL;
+	channelBusyTime[flowInfo->channel] += flowInfo->transmissionTime;
+	pthread_cond_signal(&schedulerCondVar);
+	pthread_mutex_unlock(&flowQueueMutex);
 	
 	return (void *) 0;
 }
 
 void *schedulerFunction(void *pointer)
 {
+	int channel;
+	flowPointer flowInfo;
+	(void) pointer;
+	
+	pthread_mutex_lock(&flowQueueMutex);
 	while (remainingFlows != 0)
-	{	
-		//printf("SCHEDULER: Trying to gain control of remainingFlowsMutex!\n");
-		pthread_mutex_lock(&remainingFlowsMutex);
-		//printf("SCHEDULER: Got control of remainingFlowsMutex!\n");
-		
-		//printf("SCHEDULER: Waiting for flows to finish transmitting!\n");
-		// Waits to be signaled that another flow can transmit.
-		pthread_cond_wait(&nobodyTransmittingCondVar, &remainingFlowsMutex);
-		//printf("SCHEDULER: Flow finished transmitting!\n");
-		
-		pthread_mutex_unlock(&remainingFlowsMutex);
-		
-		// While the queue of flows waiting to transmit is empty: Do nothing
-		while(flowQueue[0]->flowNumber == 0);
-		
-		pthread_mutex_lock(&flowQueueMutex);
-		// Sort the queue of flows waiting to transmit (mutexd).
-		sortQueue(flowQueue);
-		
-		// Remove the head of the queue and signal flow to transmit
-		flowPointer flowToTransmit = flowQueue[0];
-		
-		flow emptyFlow;
-		emptyFlow.flowNumber = 0;
-		flowQueue[0] = &emptyFlow;
-		
-		// Move the rest of the queue down one spot
-		int i;
-		for (i = 1; i < numberOfFlows; i ++)
+	{
+		// Move everything that has arrived into flowQueue, in the order it arrived
+		while ((flowInfo = (flowPointer) queuePop(&arrivalQueue)) != NULL)
 		{
-			flowQueue[i - 1] = flowQueue[i];
+			flowInfo->state = FLOW_WAITING;
+			heapPush(flowQueue, flowInfo);
+			flowPointer busyFlow = nextToFinish();
+			if (busyFlow != NULL)
+			{
+				logWait(flowInfo, busyFlow);
+			}
 		}
 		
-		currentlyTransmittingFlow = flowToTransmit;
-		
-		//pthread_mutex_unlock(&flowQueueMutex);
+		// Sleep until a channel is free and somebody is waiting for it. Arrivals and completions both signal
+		// schedulerCondVar while holding flowQueueMutex, so neither can be missed between the check and the wait.
+		if ((channel = findFreeChannel()) == -1 || heapPeek(flowQueue) == NULL)
+		{
+			pthread_cond_wait(&schedulerCondVar, &flowQueueMutex);
+			continue;
+		}
 		
-		//pthread_mutex_lock(&remainingFlowsMutex);
+		// Remove the head of the queue, give it the channel and signal flow to transmit
+		flowPointer flowToTransmit = (flowPointer) heapPop(flowQueue);
+		flowToTransmit->state = FLOW_TRANSMITTING;
+		flowToTransmit->channel = channel;
+		flowToTransmit->eventTime = getElapsedTime() + flowToTransmit->transmissionTime;
+		transmittingFlows[channel] = flowToTransmit;
 		remainingFlows --;
-		//printf("SCHEDULER: Signalling flow %d to begin!\n", currentlyTransmittingFlow->flowNumber);
-		pthread_cond_broadcast(&somebodyTransmittingCondVar);
-		pthread_mutex_unlock(&flowQueueMutex);
+		pthread_cond_signal(&flowToTransmit->readyToTransmitCondVar);
 	}
+	pthread_mutex_unlock(&flowQueueMutex);
 	
 	return (void *) 0;
 }
 
 double getElapsedTime()
 {
+	if (useVirtualClock)
+	{
+		return virtualTime;
+	}
+	
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	
@@ -258,6 +305,98 @@ double getElapsedTime()
 	return elapsedTime;
 }
 
+// Returns the first free channel, or -1 if every channel is transmitting.
+int findFreeChannel()
+{
+	int i;
+	for (i = 0; i < numberOfChannels; i ++)
+	{
+		if (transmittingFlows[i] == NULL)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Returns the transmitting flow that will finish first, or NULL if a channel is free so nobody has to wait.
+flowPointer nextToFinish()
+{
+	int i;
+	flowPointer firstFlow = NULL;
+	for (i = 0; i < numberOfChannels; i ++)
+	{
+		if (transmittingFlows[i] == NULL)
+		{
+			return NULL;
+		}
+		if (firstFlow == NULL || transmittingFlows[i]->eventTime < firstFlow->eventTime)
+		{
+			firstFlow = transmittingFlows[i];
+		}
+	}
+	return firstFlow;
+}
+
+// The log lines both engines print, so their output can be compared line for line. With -m they also fill in the
+// flow's metrics.
+void logArrival(flowPointer flowInfo, double time)
+{
+	if (metrics != NULL)
+	{
+		recordArrival(flowInfo, time);
+	}
+	printf("FLOW: Flow %d arrives: arrival time (%.2f), transmission time (%.1f), priority (%d) condvar address: %p.\n", flowInfo->flowNumber, time, flowInfo->transmissionTime, flowInfo->priority, &flowInfo->readyToTransmitCondVar);
+}
+
+void logWait(flowPointer flowInfo, flowPointer transmittingFlow)
+{
+	printf("FLOW: Flow %d waits for the finish of flow %d. \n", flowInfo->flowNumber, transmittingFlow->flowNumber);
+}
+
+void logStart(flowPointer flowInfo, double time)
+{
+	if (metrics != NULL)
+	{
+		recordStart(flowInfo, time);
+	}
+	if (numberOfChannels > 1)
+	{
+		printf("FLOW: Flow %d starts its transmission on channel %d at time %.2f.\n", flowInfo->flowNumber, flowInfo->channel + 1, time);
+	}
+	else
+	{
+		printf("FLOW: Flow %d starts its transmission at time %.2f.\n", flowInfo->flowNumber, time);
+	}
+}
+
+void logFinish(flowPointer flowInfo, double time)
+{
+	if (metrics != NULL)
+	{
+		recordFinish(flowInfo, time);
+	}
+	printf("FLOW: Flow %d finishes its transmission at time %.2f.\n", flowInfo->flowNumber, time);
+}
+
+void logPreempt(flowPointer flowInfo, flowPointer preemptingFlow, double time)
+{
+	if (metrics != NULL)
+	{
+		recordStop(flowInfo, time);
+	}
+	printf("FLOW: Flow %d is preempted by flow %d at time %.2f with %.2f left to transmit.\n", flowInfo->flowNumber, preemptingFlow->flowNumber, time, flowInfo->remainingTime);
+}
+
+void logUtilization(double totalTime)
+{
+	int i;
+	for (i = 0; i < numberOfChannels; i ++)
+	{
+		printf("CHANNEL: Channel %d was busy for %.2f of %.2f seconds (%.1f%%).\n", i + 1, channelBusyTime[i], totalTime, totalTime > 0 ? 100 * channelBusyTime[i] / totalTime : 0);
+	}
+}
+
 /* Return values:
 -1 if flowA > flowB
 +1 if flowA < flowB */
@@ -278,33 +417,3 @@ int compareFlows(void *pointerA, void *pointerB)
 				if (flowA->flowNumber < flowB->flowNumber) return -1;
 				else return 1;	
 }
-
-void sortQueue(void *queue)
-{
-	flowPointer *flows = (flowPointer *) queue;
-	int i;
-	int highestFlowIndex = 0;
-	flowPointer highestFlow = flows[0];
-	flowPointer currentFlow = flows[0];
-	
-	// Find the flow that should run next, and put him in spot 0.
-	for (i = 1; i < numberOfFlows; i ++)
-	{
-		currentFlow = flows[i];
-		if (currentFlow->flowNumber == 0)
-		{
-			break;
-		}
-		
-		if (compareFlows(highestFlow, currentFlow) == 1)
-		{
-			highestFlow = currentFlow;
-			highestFlowIndex = i;
-		}
-	}
-	
-	// Swap the highest flow with the one in position 0
-	flowPointer temp = flows[0];
-	flows[0] = flows[highestFlowIndex];
-	flows[highestFlowIndex] = temp;
-}
\ No newline at end of file
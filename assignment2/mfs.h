@@ -1,11 +1,78 @@
 #ifndef MFS_H_INCLUDED
 #define MFS_H_INCLUDED
 
+#include <pthread.h>
+#include "queue.h"
+
+// What happened to one flow, filled in as it passes each trace point. Everything is in seconds of simulation time.
+typedef struct {
+	int priority;
+	double arrivalTime;
+	double startTime;
+	double lastStartTime;
+	double finishTime;
+	double serviceTime;
+} flowMetrics;
+
+typedef struct {
+	int flowNumber;
+	int index; // Where the flow is in allFlows
+	float arrivalTime;
+	float transmissionTime;
+	int priority;
+	pthread_t threadId;
+	pthread_cond_t readyToTransmitCondVar;
+	queueNode arrivalNode; // Links the flow into the threaded scheduler's arrivalQueue
+
+	// The flow's next event on the event loop's timer heap, and where it is in its life
+	double eventTime;
+	int eventType;
+	long eventSequence;
+	int state;
+
+	// The channel the flow transmits on, when it last started on it and how much it has left to send
+	int channel;
+	double startTime;
+	double remainingTime;
+
+	// The flow's place in line under weighted fair queueing
+	double finishTag;
+
+	// What -m has recorded about the flow so far, copied into metrics when it finishes
+	flowMetrics record;
+} flow;
+
+typedef flow * flowPointer;
+
+// Flow states and event types for the event loop
+#define FLOW_ARRIVING 0
+#define FLOW_WAITING 1
+#define FLOW_TRANSMITTING 2
+#define FLOW_FINISHED 3
+
+#define EVENT_COMPLETION 0
+#define EVENT_ARRIVAL 1
+
+extern int numberOfFlows;
+extern flowPointer *allFlows;
+extern int useVirtualClock;
+extern double virtualTime;
+extern int numberOfChannels;
+extern flowPointer *transmittingFlows;
+extern double *channelBusyTime;
+
 void getFlows(char *fileName);
 void *flowFunction(void *pointer);
 void *schedulerFunction(void *pointer);
 double getElapsedTime();
+int findFreeChannel();
+flowPointer nextToFinish();
 int compareFlows(void *flowA, void *flowB);
-void sortQueue(void *queue);
+void logArrival(flowPointer flowInfo, double time);
+void logWait(flowPointer flowInfo, flowPointer transmittingFlow);
+void logStart(flowPointer flowInfo, double time);
+void logFinish(flowPointer flowInfo, double time);
+void logPreempt(flowPointer flowInfo, flowPointer preemptingFlow, double time);
+void logUtilization(double totalTime);
 
-#endif
\ No newline at end of file
+#endif
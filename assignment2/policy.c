@@ -0,0 +1,113 @@
+// Scheduling policies for the event loop.
+//
+// priority is the original order from compareFlows and never interrupts a transmission. preemptive uses the same
+// order but puts a flow back in the queue when a better one arrives. srtf sends the flow with the least time left to
+// transmit first, preempting too. wfq shares the link between priority classes by weight, using self-clocked fair
+// queueing: every flow gets a finish tag of max(the tag of the flow last sent, the last tag in its class) plus its
+// transmission time over its class's weight, and the smallest tag goes next. A class's weight is 1 / priority, so
+// priority 1 gets twice the share of priority 2 when both are backlogged, but no class is starved.
+
+#include <stdlib.h>
+#include <string.h>
+#include "policy.h"
+
+policy policies[] = {
+	{ "priority", compareFlows, 0, NULL, NULL },
+	{ "preemptive", compareFlows, 1, NULL, NULL },
+	{ "srtf", compareRemainingTime, 1, NULL, NULL },
+	{ "wfq", compareFinishTags, 0, tagFlow, advanceVirtualFinish },
+	{ NULL, NULL, 0, NULL, NULL }
+};
+
+policy *schedulingPolicy = &policies[0];
+
+// The finish tag of the flow last put on a channel, and the last finish tag handed out in each priority class seen
+// so far. There are only ever a few classes, so they are kept in a short list rather than indexed by priority.
+double virtualFinish = 0;
+classTag *classFinishTags = NULL;
+int numberOfClasses = 0;
+int classCapacity = 0;
+
+// Returns the policy called name, or NULL if there isn't one.
+policy *findPolicy(char *name)
+{
+	int i;
+	for (i = 0; policies[i].name != NULL; i ++)
+	{
+		if (strcmp(policies[i].name, name) == 0)
+		{
+			return &policies[i];
+		}
+	}
+	return NULL;
+}
+
+/* Return values:
+-1 if flowA has less left to transmit than flowB
++1 otherwise
+Ties fall back to compareFlows. */
+int compareRemainingTime(void *pointerA, void *pointerB)
+{
+	flowPointer flowA = (flowPointer) pointerA;
+	flowPointer flowB = (flowPointer) pointerB;
+
+	if (flowA->remainingTime < flowB->remainingTime) return -1;
+	else if (flowA->remainingTime > flowB->remainingTime) return 1;
+	else return compareFlows(flowA, flowB);
+}
+
+/* Return values:
+-1 if flowA's finish tag is smaller than flowB's
++1 otherwise
+Ties fall back to compareFlows. */
+int compareFinishTags(void *pointerA, void *pointerB)
+{
+	flowPointer flowA = (flowPointer) pointerA;
+	flowPointer flowB = (flowPointer) pointerB;
+
+	if (flowA->finishTag < flowB->finishTag) return -1;
+	else if (flowA->finishTag > flowB->finishTag) return 1;
+	else return compareFlows(flowA, flowB);
+}
+
+void tagFlow(flowPointer flowInfo)
+{
+	int class = flowInfo->priority > 0 ? flowInfo->priority : 1;
+	double weight = 1.0 / class;
+	int i = 0;
+
+	while (i < numberOfClasses && classFinishTags[i].priority != class)
+	{
+		i ++;
+	}
+	if (i == numberOfClasses)
+	{
+		if (numberOfClasses == classCapacity)
+		{
+			classCapacity = classCapacity > 0 ? classCapacity * 2 : 4;
+			classFinishTags = realloc(classFinishTags, classCapacity * sizeof(classTag));
+		}
+		classFinishTags[i].priority = class;
+		classFinishTags[i].finishTag = 0;
+		numberOfClasses ++;
+	}
+
+	double start = classFinishTags[i].finishTag > virtualFinish ? classFinishTags[i].finishTag : virtualFinish;
+	flowInfo->finishTag = start + (flowInfo->transmissionTime / weight);
+	classFinishTags[i].finishTag = flowInfo->finishTag;
+}
+
+void advanceVirtualFinish(flowPointer flowInfo)
+{
+	virtualFinish = flowInfo->finishTag;
+}
+
+// Frees whatever state the policies built up during a run.
+void freePolicy()
+{
+	free(classFinishTags);
+	classFinishTags = NULL;
+	numberOfClasses = 0;
+	classCapacity = 0;
+	virtualFinish = 0;
+}
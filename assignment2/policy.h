@@ -0,0 +1,33 @@
+#ifndef POLICY_H_INCLUDED
+#define POLICY_H_INCLUDED
+
+#include "mfs.h"
+
+// How the event loop picks the next flow to transmit. compare orders the waiting flows like compareFlows does. A
+// preemptive policy also takes a channel back from a transmitting flow when a waiting flow comes out before it.
+// arrive and dispatch, if set, are called when a flow starts waiting and when it is put on a channel.
+typedef struct {
+	char *name;
+	int (*compare)(void *flowA, void *flowB);
+	int preemptive;
+	void (*arrive)(flowPointer flowInfo);
+	void (*dispatch)(flowPointer flowInfo);
+} policy;
+
+// The last finish tag handed out to flows of one priority
+typedef struct {
+	int priority;
+	double finishTag;
+} classTag;
+
+extern policy policies[];
+extern policy *schedulingPolicy;
+
+policy *findPolicy(char *name);
+int compareRemainingTime(void *flowA, void *flowB);
+int compareFinishTags(void *flowA, void *flowB);
+void tagFlow(flowPointer flowInfo);
+void advanceVirtualFinish(flowPointer flowInfo);
+void freePolicy();
+
+#endif
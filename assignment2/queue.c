@@ -0,0 +1,69 @@
+// Dmitry Vyukov's intrusive multiple producer, single consumer queue.
+//
+// A push is a single atomic exchange on head followed by linking the old head to the new node, so producers never
+// wait on each other or on the consumer. The consumer follows next pointers from tail. The stub node keeps the list
+// from ever being empty, which is what lets the last real node be popped without racing a push.
+//
+// Between a producer's exchange and its link, the node is in the queue but can't be reached yet, so queuePop can
+// return NULL while something is queued. Callers have to be told about each push some other way (the flow scheduler
+// signals a condvar after pushing) rather than polling queuePop until it returns something.
+
+#include <stddef.h>
+#include "queue.h"
+
+void initQueue(queue *q)
+{
+	atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+	q->stub.item = NULL;
+	atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+	q->tail = &q->stub;
+}
+
+void queuePush(queue *q, queueNode *node, void *item)
+{
+	node->item = item;
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	queueNode *previous = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+	atomic_store_explicit(&previous->next, node, memory_order_release);
+}
+
+// Returns the oldest item in the queue, or NULL if there is nothing that can be popped yet.
+void *queuePop(queue *q)
+{
+	queueNode *tail = q->tail;
+	queueNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	// Step over the stub
+	if (tail == &q->stub)
+	{
+		if (next == NULL)
+		{
+			return NULL;
+		}
+		q->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+
+	if (next != NULL)
+	{
+		q->tail = next;
+		return tail->item;
+	}
+
+	// tail looks like the last node. If it isn't, a push is halfway done and we have to wait for it.
+	if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+	{
+		return NULL;
+	}
+
+	// Put the stub back behind tail so tail can be popped
+	queuePush(q, &q->stub, NULL);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next != NULL)
+	{
+		q->tail = next;
+		return tail->item;
+	}
+	return NULL;
+}
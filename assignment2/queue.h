@@ -0,0 +1,23 @@
+#ifndef QUEUE_H_INCLUDED
+#define QUEUE_H_INCLUDED
+
+#include <stdatomic.h>
+
+// Lock free first in first out queue that any number of threads can push to but only one thread pops from. The node
+// lives inside whatever is queued, so pushing never allocates; a node can only be in one queue at a time.
+typedef struct queueNode {
+	_Atomic(struct queueNode *) next;
+	void *item;
+} queueNode;
+
+typedef struct {
+	_Atomic(queueNode *) head; // The last node pushed
+	queueNode *tail; // The next node to pop, only touched by the consumer
+	queueNode stub;
+} queue;
+
+void initQueue(queue *q);
+void queuePush(queue *q, queueNode *node, void *item);
+void *queuePop(queue *q);
+
+#endif
@@ -0,0 +1,303 @@
+// Batch mode shared by diskinfo and disklist.
+//
+// A list file or a directory of images is handed to a pool of worker threads. Each worker claims the next
+// image, maps it, and writes its report into a private memory stream. The main thread prints the finished
+// reports strictly in input order, so the output is the same whatever the number of workers.
+//
+// The last CSV column is error, empty on the rows of an image that was reported on. An image that can't be read,
+// or that the report finds something wrong with, gets a row with its name and the message in that column (or a
+// JSON object with an "error" field), and counts as a failure.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h> // strcasecmp
+#include <dirent.h> // opendir
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>  // mmap
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include "disk_layout.h"
+#include "batch.h"
+
+typedef struct {
+	char *output;
+	size_t length;
+	int failed;
+	int done;
+} batch_result;
+
+typedef struct {
+	char **images;
+	int num_images;
+	int format;
+	int num_fields;
+	batch_report report;
+	atomic_int next_image;
+	batch_result *results;
+	pthread_mutex_t results_mutex;
+	pthread_cond_t result_done_cond_var;
+} batch_state;
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+// Fills images with the paths named in source: every regular file in it if it is a directory, otherwise one
+// path per line of the file. Returns the number of images, or -1 if source can't be read.
+int get_batch_images(char *source, char ***images) {
+	int num_images = 0;
+	int capacity = 64;
+	*images = malloc(capacity * sizeof(char *));
+
+	struct stat source_stats;
+	if (stat(source, &source_stats) < 0) {
+		free(*images);
+		return -1;
+	}
+
+	if (S_ISDIR(source_stats.st_mode)) {
+		DIR *directory = opendir(source);
+		struct dirent *dir_entry;
+		if (directory == NULL) {
+			free(*images);
+			return -1;
+		}
+
+		while ((dir_entry = readdir(directory)) != NULL) {
+			char *path = malloc(strlen(source) + strlen(dir_entry->d_name) + 2);
+			struct stat image_stats;
+			sprintf(path, "%s/%s", source, dir_entry->d_name);
+			if (dir_entry->d_name[0] == '.' || stat(path, &image_stats) < 0 || !S_ISREG(image_stats.st_mode)) {
+				free(path);
+				continue;
+			}
+
+			if (num_images == capacity) {
+				capacity *= 2;
+				*images = realloc(*images, capacity * sizeof(char *));
+			}
+			(*images)[num_images ++] = path;
+		}
+		closedir(directory);
+
+		// readdir order is arbitrary; sort so runs are repeatable
+		qsort(*images, num_images, sizeof(char *), compare_names);
+	} else {
+		FILE *list = fopen(source, "r");
+		char *line = NULL;
+		size_t line_capacity = 0;
+		ssize_t line_length;
+		if (list == NULL) {
+			free(*images);
+			return -1;
+		}
+
+		while ((line_length = getline(&line, &line_capacity, list)) >= 0) {
+			while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')) {
+				line[-- line_length] = '\0';
+			}
+			if (line_length == 0) {
+				continue;
+			}
+
+			if (num_images == capacity) {
+				capacity *= 2;
+				*images = realloc(*images, capacity * sizeof(char *));
+			}
+			(*images)[num_images ++] = strdup(line);
+		}
+		free(line);
+		fclose(list);
+	}
+
+	return num_images;
+}
+
+void free_batch_images(char **images, int num_images) {
+	int i;
+	for (i = 0; i < num_images; i ++) {
+		free(images[i]);
+	}
+	free(images);
+}
+
+// Returns BATCH_CSV or BATCH_JSONL for a format name, or -1 if it is not one of them.
+int get_batch_format(char *name) {
+	if (strcasecmp(name, "csv") == 0) {
+		return BATCH_CSV;
+	}
+	if (strcasecmp(name, "jsonl") == 0) {
+		return BATCH_JSONL;
+	}
+	return -1;
+}
+
+int get_default_workers() {
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	return online > 0 ? online : 1;
+}
+
+// An error row: the image, the report's own fields left empty, then the message.
+static void print_error_row(batch_state *state, FILE *out, char *image, const char *message) {
+	int i;
+	if (state->format == BATCH_CSV) {
+		print_csv_string(out, image);
+		for (i = 0; i < state->num_fields; i ++) {
+			fputc(',', out);
+		}
+		fputc(',', out);
+		print_csv_string(out, message);
+		fputc('\n', out);
+	} else {
+		fprintf(out, "{\"image\":");
+		print_json_string(out, image);
+		fprintf(out, ",\"error\":");
+		print_json_string(out, message);
+		fprintf(out, "}\n");
+	}
+}
+
+static void report_image(batch_state *state, int index) {
+	char *image = state->images[index];
+	batch_result *result = &state->results[index];
+	FILE *out = open_memstream(&result->output, &result->length);
+	const char *error = NULL;
+
+	int fd;
+	struct stat file_stats;
+	char *map;
+	if ((fd = open(image, O_RDONLY)) < 0) {
+		error = "Error opening file for reading";
+	} else {
+		// Return information about the file and store it in file_stats
+		fstat(fd, &file_stats);
+
+		map = mmap(NULL, file_stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			error = "Error mapping file system image";
+		} else {
+			if (is_fat12_image(map, file_stats.st_size)) {
+				error = state->report(image, map, out, state->format);
+			} else {
+				error = "Not a FAT12 image";
+			}
+			munmap(map, file_stats.st_size);
+		}
+		close(fd);
+	}
+
+	if (error != NULL) {
+		print_error_row(state, out, image, error);
+		result->failed = 1;
+	}
+	fclose(out);
+
+	pthread_mutex_lock(&state->results_mutex);
+	result->done = 1;
+	pthread_cond_broadcast(&state->result_done_cond_var);
+	pthread_mutex_unlock(&state->results_mutex);
+}
+
+static void *batch_worker(void *pointer) {
+	batch_state *state = (batch_state *) pointer;
+	int index;
+
+	while ((index = atomic_fetch_add(&state->next_image, 1)) < state->num_images) {
+		report_image(state, index);
+	}
+
+	return (void *) 0;
+}
+
+// Reports on every image using num_workers threads and prints the reports to stdout in input order, after
+// csv_header (which ends with the error column) for CSV. Returns the number of images that got an error row.
+int run_batch(char **images, int num_images, int num_workers, int format, char *csv_header, batch_report report) {
+	batch_state state;
+	int failures = 0;
+	int i;
+
+	state.images = images;
+	state.num_images = num_images;
+	state.format = format;
+	state.report = report;
+
+	// Every column but image and error is one of the report's fields
+	state.num_fields = -1;
+	for (i = 0; csv_header[i] != '\0'; i ++) {
+		state.num_fields += csv_header[i] == ',';
+	}
+	if (format == BATCH_CSV) {
+		printf("%s\n", csv_header);
+	}
+	atomic_init(&state.next_image, 0);
+	state.results = calloc(num_images, sizeof(batch_result));
+	pthread_mutex_init(&state.results_mutex, NULL);
+	pthread_cond_init(&state.result_done_cond_var, NULL);
+
+	if (num_workers > num_images) {
+		num_workers = num_images;
+	}
+	pthread_t *workers = malloc(num_workers * sizeof(pthread_t));
+	for (i = 0; i < num_workers; i ++) {
+		pthread_create(&workers[i], NULL, batch_worker, &state);
+	}
+
+	// Print each report as soon as it and everything before it is done
+	for (i = 0; i < num_images; i ++) {
+		pthread_mutex_lock(&state.results_mutex);
+		while (!state.results[i].done) {
+			pthread_cond_wait(&state.result_done_cond_var, &state.results_mutex);
+		}
+		pthread_mutex_unlock(&state.results_mutex);
+
+		fwrite(state.results[i].output, 1, state.results[i].length, stdout);
+		free(state.results[i].output);
+		failures += state.results[i].failed;
+	}
+
+	for (i = 0; i < num_workers; i ++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	free(workers);
+	free(state.results);
+	pthread_mutex_destroy(&state.results_mutex);
+	pthread_cond_destroy(&state.result_done_cond_var);
+	return failures;
+}
+
+// Quotes a CSV field only if it needs it, doubling any quotes inside it.
+void print_csv_string(FILE *out, const char *value) {
+	if (strpbrk(value, ",\"\r\n") == NULL) {
+		fputs(value, out);
+		return;
+	}
+
+	fputc('"', out);
+	for (; *value != '\0'; value ++) {
+		if (*value == '"') {
+			fputc('"', out);
+		}
+		fputc(*value, out);
+	}
+	fputc('"', out);
+}
+
+void print_json_string(FILE *out, const char *value) {
+	fputc('"', out);
+	for (; *value != '\0'; value ++) {
+		unsigned char c = *value;
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c < 0x20 || c >= 0x7F) {
+			// Names on the disk are in an OEM code page, so anything outside ASCII is escaped as is
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
@@ -0,0 +1,22 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <stdio.h>
+
+// Output formats for batch mode
+#define BATCH_CSV 0
+#define BATCH_JSONL 1
+
+// Writes the report for one mapped image to out. Called from the worker threads, so it must not touch globals.
+// Returns NULL, or a message saying what is wrong with the image, which run_batch adds as an error row.
+typedef const char *(*batch_report)(char *image_name, char *mmap, FILE *out, int format);
+
+int get_batch_images(char *source, char ***images);
+void free_batch_images(char **images, int num_images);
+int get_batch_format(char *name);
+int get_default_workers();
+int run_batch(char **images, int num_images, int num_workers, int format, char *csv_header, batch_report report);
+void print_csv_string(FILE *out, const char *value);
+void print_json_string(FILE *out, const char *value);
+
+#endif
@@ -0,0 +1,252 @@
+// Write-back cache over a file system image.
+//
+// The image is mapped copy-on-write, so the tools can keep changing it in place through the mapping without
+// any of it reaching the file. Every change is recorded as a range of dirty sectors, and commit_block_cache
+// writes them back in an order that can't leave a directory entry or FAT chain pointing at missing data:
+//
+// 1. dirty data clusters, then fdatasync. They are free in the FAT on disk, so nothing can see them yet.
+// 2. with a journal, the current contents of the metadata about to be overwritten go to <image>.journal,
+//    then fsync of the journal and its directory.
+// 3. the boot sector, FATs and root directory from the first to the last dirty sector in one write, then fsync.
+// 4. the journal is removed.
+//
+// If a put is interrupted during step 3 the journal is still there, and the next open writes the old metadata
+// back, which rolls the image back to how it was before the put. A journal that was itself cut short means
+// step 3 never started, so it is just removed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>  // mmap
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include <string.h>
+#include <errno.h>
+#include "disk_layout.h"
+#include "block_cache.h"
+
+#define JOURNAL_MAGIC "FAT12JNL"
+
+typedef struct {
+	char magic[8];
+	int64_t offset;
+	uint32_t length;
+	uint32_t checksum;
+} journal_header;
+
+// FNV-1a, enough to tell a complete journal from one that was cut short
+static uint32_t journal_checksum(const char *data, long length) {
+	uint32_t hash = 2166136261u;
+	long i;
+	for (i = 0; i < length; i ++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Writes length bytes of data at offset, picking up where a short write left off.
+static int write_span(int fd, const char *data, long length, long offset) {
+	while (length > 0) {
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += written;
+		offset += written;
+		length -= written;
+	}
+	return 0;
+}
+
+// Makes the journal's directory entry durable, so the journal can't vanish while the metadata is half written.
+static int sync_directory_of(char *path) {
+	char *slash = strrchr(path, '/');
+	char *directory = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+	int dir_fd = open(directory, O_RDONLY);
+	free(directory);
+	if (dir_fd < 0) {
+		return -1;
+	}
+	int result = fsync(dir_fd);
+	close(dir_fd);
+	return result;
+}
+
+// Undoes an interrupted commit by writing the saved metadata back over the image.
+// Returns 1 if the image was rolled back, 0 if there was nothing to do, or -1 on an error (errno is set).
+int recover_journal(int fd, char *journal_path) {
+	int journal_fd = open(journal_path, O_RDONLY);
+	if (journal_fd < 0) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	journal_header header;
+	char *saved = NULL;
+	int complete = 0;
+	if (read(journal_fd, &header, sizeof(header)) == sizeof(header) && memcmp(header.magic, JOURNAL_MAGIC, 8) == 0) {
+		saved = malloc(header.length);
+		complete = saved != NULL && read(journal_fd, saved, header.length) == header.length
+			&& journal_checksum(saved, header.length) == header.checksum;
+	}
+	close(journal_fd);
+
+	if (complete && (write_span(fd, saved, header.length, header.offset) < 0 || fsync(fd) < 0)) {
+		free(saved);
+		return -1;
+	}
+
+	free(saved);
+	unlink(journal_path);
+	return complete;
+}
+
+// Opens an image for changing through the cache, rolling back an interrupted commit first.
+// Returns NULL on an error (errno is set, to EINVAL if the file isn't a FAT12 image).
+block_cache *open_block_cache(char *image_path, int journaled) {
+	block_cache *cache = malloc(sizeof(block_cache));
+	struct stat file_stats;
+
+	cache->journal_path = malloc(strlen(image_path) + strlen(".journal") + 1);
+	sprintf(cache->journal_path, "%s.journal", image_path);
+	cache->journaled = journaled;
+
+	if ((cache->fd = open(image_path, O_RDWR)) < 0 || recover_journal(cache->fd, cache->journal_path) < 0
+		|| fstat(cache->fd, &file_stats) < 0) {
+		free(cache->journal_path);
+		free(cache);
+		return NULL;
+	}
+
+	cache->size = file_stats.st_size;
+	cache->mmap = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cache->fd, 0);
+	if (cache->mmap == MAP_FAILED || !is_fat12_image(cache->mmap, cache->size)) {
+		int error = cache->mmap == MAP_FAILED ? errno : EINVAL;
+		if (cache->mmap != MAP_FAILED) {
+			munmap(cache->mmap, cache->size);
+		}
+		close(cache->fd);
+		free(cache->journal_path);
+		free(cache);
+		errno = error;
+		return NULL;
+	}
+
+	disk_geometry geometry;
+	get_disk_geometry(cache->mmap, &geometry);
+	cache->bytes_per_sector = geometry.bytes_per_sector;
+	cache->first_data_sector = geometry.first_data_sector;
+	cache->num_sectors = cache->size / cache->bytes_per_sector;
+	cache->dirty = calloc((cache->num_sectors + 7) / 8, 1);
+	return cache;
+}
+
+// Records that the bytes from offset to offset + length were changed in the mapping.
+void mark_dirty(block_cache *cache, long offset, long length) {
+	if (length <= 0) {
+		return;
+	}
+
+	long sector;
+	long last = (offset + length - 1) / cache->bytes_per_sector;
+	for (sector = offset / cache->bytes_per_sector; sector <= last && sector < cache->num_sectors; sector ++) {
+		cache->dirty[sector / 8] |= 1 << (sector % 8);
+	}
+}
+
+static int is_dirty(block_cache *cache, long sector) {
+	return (cache->dirty[sector / 8] >> (sector % 8)) & 1;
+}
+
+// Writes every dirty sector back to the image in the order described above.
+// Returns 0 on success or -1 on an error (errno is set).
+int commit_block_cache(block_cache *cache) {
+	int bytes_per_sector = cache->bytes_per_sector;
+	long sector;
+
+	// Data first, one write per run of dirty sectors
+	int wrote_data = 0;
+	for (sector = cache->first_data_sector; sector < cache->num_sectors; sector ++) {
+		if (!is_dirty(cache, sector)) {
+			continue;
+		}
+
+		long run_start = sector;
+		while (sector < cache->num_sectors && is_dirty(cache, sector)) {
+			sector ++;
+		}
+		long offset = run_start * bytes_per_sector;
+		if (write_span(cache->fd, cache->mmap + offset, (sector - run_start) * bytes_per_sector, offset) < 0) {
+			return -1;
+		}
+		wrote_data = 1;
+	}
+	if (wrote_data && fdatasync(cache->fd) < 0) {
+		return -1;
+	}
+
+	// The metadata sits at the front of the image, so one span covers every dirty sector of it
+	long first_dirty = -1;
+	long last_dirty = -1;
+	for (sector = 0; sector < cache->first_data_sector && sector < cache->num_sectors; sector ++) {
+		if (is_dirty(cache, sector)) {
+			first_dirty = first_dirty < 0 ? sector : first_dirty;
+			last_dirty = sector;
+		}
+	}
+
+	if (first_dirty >= 0) {
+		long offset = first_dirty * bytes_per_sector;
+		long length = (last_dirty - first_dirty + 1) * bytes_per_sector;
+
+		if (cache->journaled) {
+			// The mapping already holds the new metadata, so the old copy comes from the file itself
+			char *saved = malloc(length);
+			journal_header header;
+			memcpy(header.magic, JOURNAL_MAGIC, 8);
+			header.offset = offset;
+			header.length = length;
+
+			int journal_fd = -1;
+			int failed = pread(cache->fd, saved, length, offset) != length
+				|| (journal_fd = open(cache->journal_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0;
+			if (!failed) {
+				header.checksum = journal_checksum(saved, length);
+				failed = write_span(journal_fd, (char *) &header, sizeof(header), 0) < 0
+					|| write_span(journal_fd, saved, length, sizeof(header)) < 0
+					|| fsync(journal_fd) < 0 || sync_directory_of(cache->journal_path) < 0;
+			}
+			if (journal_fd >= 0) {
+				close(journal_fd);
+			}
+			free(saved);
+			if (failed) {
+				return -1;
+			}
+		}
+
+		if (write_span(cache->fd, cache->mmap + offset, length, offset) < 0 || fsync(cache->fd) < 0) {
+			return -1;
+		}
+
+		if (cache->journaled) {
+			unlink(cache->journal_path);
+		}
+	}
+
+	memset(cache->dirty, 0, (cache->num_sectors + 7) / 8);
+	return 0;
+}
+
+// Drops the cache. Anything not committed is lost.
+void close_block_cache(block_cache *cache) {
+	munmap(cache->mmap, cache->size);
+	close(cache->fd);
+	free(cache->dirty);
+	free(cache->journal_path);
+	free(cache);
+}
@@ -0,0 +1,26 @@
+#ifndef BLOCK_CACHE_H_INCLUDED
+#define BLOCK_CACHE_H_INCLUDED
+
+// A copy-on-write view of an image that remembers which sectors were changed. Nothing reaches the image
+// until commit_block_cache writes the dirty sectors back in a safe order.
+typedef struct {
+	int fd;
+	char *mmap;
+	long size;
+	int bytes_per_sector;
+	int first_data_sector;
+	int num_sectors;
+	unsigned char *dirty;
+
+	// Where the old metadata is saved while it is being overwritten. Only written when journaled is set.
+	char *journal_path;
+	int journaled;
+} block_cache;
+
+block_cache *open_block_cache(char *image_path, int journaled);
+void mark_dirty(block_cache *cache, long offset, long length);
+int commit_block_cache(block_cache *cache);
+void close_block_cache(block_cache *cache);
+int recover_journal(int fd, char *journal_path);
+
+#endif
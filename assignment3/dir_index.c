@@ -0,0 +1,173 @@
+// Root directory index.
+//
+// The root directory is read once when the image is opened and every name is put in an open addressing hash
+// table, so looking a file up costs one hash instead of a scan of the directory. The free entries found on the
+// way are kept too, so adding a file needs no scan either. diskput keeps the index current as it adds entries.
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h> // toupper, isalnum
+#include "disk_layout.h"
+#include "dir_index.h"
+
+// FNV-1a over the 11 byte name
+static unsigned int hash_name(const char *short_name) {
+	unsigned int hash = 2166136261u;
+	int i;
+	for (i = 0; i < 11; i ++) {
+		hash ^= (unsigned char) short_name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void insert_slot(dir_index *index, dir_index_slot *slot) {
+	unsigned int i = hash_name(slot->name) & (index->capacity - 1);
+	while (index->slots[i].entry_offset >= 0) {
+		i = (i + 1) & (index->capacity - 1);
+	}
+	index->slots[i] = *slot;
+}
+
+// Doubles the table and rehashes every slot into it.
+static void grow_index(dir_index *index) {
+	dir_index_slot *old_slots = index->slots;
+	int old_capacity = index->capacity;
+	int i;
+
+	index->capacity *= 2;
+	index->slots = malloc(index->capacity * sizeof(dir_index_slot));
+	for (i = 0; i < index->capacity; i ++) {
+		index->slots[i].entry_offset = -1;
+	}
+	for (i = 0; i < old_capacity; i ++) {
+		if (old_slots[i].entry_offset >= 0) {
+			insert_slot(index, &old_slots[i]);
+		}
+	}
+	free(old_slots);
+}
+
+dir_index *build_root_index(char *mmap) {
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+
+	dir_index *index = malloc(sizeof(dir_index));
+	index->count = 0;
+	index->free_offsets = malloc(geometry.root_entries * sizeof(long));
+	index->num_free = 0;
+	index->next_free = 0;
+
+	// Keep the load factor at or below a half even if the root directory fills up
+	index->capacity = 16;
+	while (index->capacity < geometry.root_entries * 2) {
+		index->capacity *= 2;
+	}
+	index->slots = malloc(index->capacity * sizeof(dir_index_slot));
+	int i;
+	for (i = 0; i < index->capacity; i ++) {
+		index->slots[i].entry_offset = -1;
+	}
+
+	int end_of_directory = 0;
+	for (i = 0; i < geometry.root_entries; i ++) {
+		long offset = get_root_entry_offset(&geometry, i);
+		int attributeValue = mmap[offset + 11];
+
+		// 0x00 means this and all the remaining entries are free, 0xE5 marks a deleted entry
+		if (end_of_directory || mmap[offset] == 0x00 || (unsigned char) mmap[offset] == 0xE5) {
+			end_of_directory = end_of_directory || mmap[offset] == 0x00;
+			index->free_offsets[index->num_free ++] = offset;
+			continue;
+		}
+
+		// Long file name pieces and the volume label don't name anything
+		if ((attributeValue & 0x0F) == 0x0F || (attributeValue & 0x08) == 0x08) {
+			continue;
+		}
+
+		add_to_index(index, mmap + offset, attributeValue, read_le16(&DIRECTORY_ENTRY(mmap, offset)->first_cluster), offset);
+	}
+
+	return index;
+}
+
+void free_dir_index(dir_index *index) {
+	free(index->slots);
+	free(index->free_offsets);
+	free(index);
+}
+
+// Returns the slot for short_name, or NULL if there is no such entry.
+dir_index_slot *find_in_index(dir_index *index, const char *short_name) {
+	unsigned int i = hash_name(short_name) & (index->capacity - 1);
+	while (index->slots[i].entry_offset >= 0) {
+		if (memcmp(index->slots[i].name, short_name, 11) == 0) {
+			return &index->slots[i];
+		}
+		i = (i + 1) & (index->capacity - 1);
+	}
+	return NULL;
+}
+
+void add_to_index(dir_index *index, const char *short_name, int attributes, int first_cluster, long entry_offset) {
+	dir_index_slot slot;
+	memcpy(slot.name, short_name, 11);
+	slot.attributes = attributes;
+	slot.first_cluster = first_cluster;
+	slot.entry_offset = entry_offset;
+
+	if ((index->count + 1) * 2 > index->capacity) {
+		grow_index(index);
+	}
+	insert_slot(index, &slot);
+	index->count ++;
+}
+
+// Returns the offset of the first free root directory entry and marks it used, or -1 if the root is full.
+long take_free_entry(dir_index *index) {
+	if (index->next_free == index->num_free) {
+		return -1;
+	}
+	return index->free_offsets[index->next_free ++];
+}
+
+// Characters an 8.3 name may hold besides letters, digits and bytes above 127
+static int is_short_name_char(unsigned char c) {
+	return isalnum(c) || c >= 0x80 || (c != '\0' && strchr("!#$%&'()-@^_`{}~", c) != NULL);
+}
+
+// Turns foo.txt into the space padded, upper case 8.3 form "FOO     TXT". Returns 0, or -1 if the name (after
+// any leading directories) isn't a valid 8.3 name: one to eight legal characters, optionally followed by one dot
+// and one to three more. short_name is left untouched then.
+int make_short_name(char *short_name, const char *file_name) {
+	const char *base = strrchr(file_name, '/');
+	base = base ? base + 1 : file_name;
+	const char *dot = strchr(base, '.');
+	int name_length = dot ? (int) (dot - base) : (int) strlen(base);
+	int extension_length = dot ? (int) strlen(dot + 1) : 0;
+	int i;
+
+	if (name_length < 1 || name_length > 8 || (dot && (extension_length < 1 || extension_length > 3))) {
+		return -1;
+	}
+	for (i = 0; i < name_length; i ++) {
+		if (!is_short_name_char((unsigned char) base[i])) {
+			return -1;
+		}
+	}
+	for (i = 0; i < extension_length; i ++) {
+		if (!is_short_name_char((unsigned char) dot[i + 1])) {
+			return -1;
+		}
+	}
+
+	memset(short_name, ' ', 11);
+	for (i = 0; i < name_length; i ++) {
+		short_name[i] = toupper((unsigned char) base[i]);
+	}
+	for (i = 0; i < extension_length; i ++) {
+		short_name[8 + i] = toupper((unsigned char) dot[i + 1]);
+	}
+	return 0;
+}
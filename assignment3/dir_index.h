@@ -0,0 +1,30 @@
+#ifndef DIR_INDEX_H_INCLUDED
+#define DIR_INDEX_H_INCLUDED
+
+// A hash of the root directory keyed by the 11 byte, space padded, upper case 8.3 name.
+typedef struct {
+	char name[11];
+	int attributes;
+	int first_cluster;
+	long entry_offset;
+} dir_index_slot;
+
+typedef struct {
+	dir_index_slot *slots;
+	int capacity;
+	int count;
+
+	// Reusable directory entries, in directory order, handed out from next_free
+	long *free_offsets;
+	int num_free;
+	int next_free;
+} dir_index;
+
+dir_index *build_root_index(char *mmap);
+void free_dir_index(dir_index *index);
+dir_index_slot *find_in_index(dir_index *index, const char *short_name);
+void add_to_index(dir_index *index, const char *short_name, int attributes, int first_cluster, long entry_offset);
+long take_free_entry(dir_index *index);
+int make_short_name(char *short_name, const char *file_name);
+
+#endif
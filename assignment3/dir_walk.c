@@ -0,0 +1,304 @@
+// Parallel walk of the whole directory tree.
+//
+// Every directory still to be read is a task. Each worker keeps its own deque of tasks: it pushes the
+// subdirectories it finds onto the bottom and pops from the bottom, so it works depth first on data it has
+// just touched, and when it runs dry it steals from the top of another worker's deque. Found entries are
+// appended to one shared array by an atomic add on its length, so workers never wait on each other to
+// record results. A bitmap of directory clusters already queued keeps a corrupt image from sending the
+// walk round a loop.
+//
+// Every task carries the length of its directory's path, so each entry's path length is known exactly when it is
+// found. A directory whose entries' paths might not fit in WALK_PATH_MAX is not walked into. It is marked
+// skipped and counted, along with any entries that didn't fit in the array, so callers know the walk is
+// incomplete rather than getting a tree with pieces silently missing or paths cut short.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h> // sched_yield
+#include <pthread.h>
+#include <stdatomic.h>
+#include "disk_layout.h"
+#include "dir_walk.h"
+
+typedef struct {
+	int cluster;
+	int index;
+	int path_length;
+} walk_task;
+
+typedef struct {
+	walk_task *tasks;
+	int top;
+	int bottom;
+	int capacity;
+	pthread_mutex_t mutex;
+} walk_deque;
+
+typedef struct {
+	char *mmap;
+	fat_table *table;
+	disk_geometry geometry;
+	walk_entry *entries;
+	int capacity;
+	atomic_int num_entries;
+	atomic_int num_skipped;
+	walk_deque *deques;
+	int num_workers;
+	atomic_int pending;
+	atomic_uint_least64_t *visited;
+} walk_state;
+
+typedef struct {
+	walk_state *state;
+	int id;
+} walk_worker;
+
+static void push_task(walk_deque *deque, walk_task task) {
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom == deque->capacity) {
+		// Slide the live tasks back to the front before growing
+		if (deque->top > 0) {
+			memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(walk_task));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		} else {
+			deque->capacity *= 2;
+			deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(walk_task));
+		}
+	}
+	deque->tasks[deque->bottom ++] = task;
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+// Takes the newest task off the worker's own deque. Returns 0 if it is empty.
+static int pop_task(walk_deque *deque, walk_task *task) {
+	int found = 0;
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom > deque->top) {
+		*task = deque->tasks[-- deque->bottom];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return found;
+}
+
+// Takes the oldest task off another worker's deque. Returns 0 if it is empty.
+static int steal_task(walk_deque *deque, walk_task *task) {
+	int found = 0;
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom > deque->top) {
+		*task = deque->tasks[deque->top ++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&deque->mutex);
+	return found;
+}
+
+// Records the directory entry at offset. Returns 0 once the end of the directory is reached.
+static int visit_entry(walk_state *state, int worker_id, walk_task *task, long offset) {
+	char *mmap = state->mmap;
+	int attributeValue = mmap[offset + 11];
+
+	// If the first byte of the Filename field is 0x00, then this directory entry is free and all the
+	// remaining directory entries in this directory are also free.
+	if (mmap[offset] == 0x00) {
+		return 0;
+	}
+
+	// Skip deleted entries, long file name pieces, the volume label, and the . and .. links
+	if (!is_named_entry(mmap, offset) || mmap[offset] == '.') {
+		return 1;
+	}
+
+	int index = atomic_fetch_add(&state->num_entries, 1);
+	if (index >= state->capacity) {
+		// Only possible when directories share clusters; the extra entries are dropped
+		atomic_fetch_add(&state->num_skipped, 1);
+		return 1;
+	}
+	char name[13];
+	get_entry_name(mmap, name, offset);
+	int path_length = task->path_length + 1 + strlen(name);
+	state->entries[index].entry_offset = offset;
+	state->entries[index].parent = task->index;
+	state->entries[index].path_length = path_length;
+	state->entries[index].skipped = 0;
+
+	// The directory's entries add a slash and up to twelve characters of 8.3 name to its path
+	if ((attributeValue & 0x10) == 0x10 && path_length + 1 + 12 >= WALK_PATH_MAX) {
+		state->entries[index].skipped = 1;
+		atomic_fetch_add(&state->num_skipped, 1);
+	} else if ((attributeValue & 0x10) == 0x10) {
+		int cluster = read_le16(&DIRECTORY_ENTRY(mmap, offset)->first_cluster);
+		uint_least64_t bit = (uint_least64_t) 1 << (cluster % 64);
+		if (cluster >= 2 && cluster < state->geometry.total_clusters + 2 && (atomic_fetch_or(&state->visited[cluster / 64], bit) & bit) == 0) {
+			walk_task subdirectory = { cluster, index, path_length };
+			atomic_fetch_add(&state->pending, 1);
+			push_task(&state->deques[worker_id], subdirectory);
+		}
+	}
+
+	return 1;
+}
+
+static void scan_directory(walk_state *state, int worker_id, walk_task *task) {
+	disk_geometry *geometry = &state->geometry;
+	int i;
+
+	// The root directory has a fixed size and place; subdirectories are cluster chains
+	if (task->cluster == 0) {
+		for (i = 0; i < geometry->root_entries; i ++) {
+			if (!visit_entry(state, worker_id, task, get_root_entry_offset(geometry, i))) {
+				return;
+			}
+		}
+		return;
+	}
+
+	int entries_per_cluster = geometry->bytes_per_cluster / 32;
+	int cluster = task->cluster;
+	int steps;
+	for (steps = 0; cluster >= 2 && cluster < geometry->total_clusters + 2 && steps < geometry->total_clusters; steps ++) {
+		long cluster_offset = get_cluster_offset(geometry, cluster);
+		for (i = 0; i < entries_per_cluster; i ++) {
+			if (!visit_entry(state, worker_id, task, cluster_offset + (i * 32))) {
+				return;
+			}
+		}
+		cluster = state->table->entries[cluster];
+	}
+}
+
+static void *walk_worker_function(void *pointer) {
+	walk_worker *worker = (walk_worker *) pointer;
+	walk_state *state = worker->state;
+	walk_task task;
+
+	while (atomic_load(&state->pending) > 0) {
+		int found = pop_task(&state->deques[worker->id], &task);
+		int i;
+		for (i = 1; !found && i < state->num_workers; i ++) {
+			found = steal_task(&state->deques[(worker->id + i) % state->num_workers], &task);
+		}
+
+		if (!found) {
+			// Someone is still scanning and may yet push more work
+			sched_yield();
+			continue;
+		}
+
+		scan_directory(state, worker->id, &task);
+		atomic_fetch_sub(&state->pending, 1);
+	}
+
+	return (void *) 0;
+}
+
+// Finds every file and directory on the disk using num_workers threads. entries is set to a malloc'd array
+// in no particular order. Returns the number of entries in it. If num_skipped isn't NULL it is set to the number of
+// directories that were not walked into plus the number of entries that were dropped; the walk is only complete
+// if that is 0.
+int walk_directories(char *mmap, fat_table *table, int num_workers, walk_entry **entries, int *num_skipped) {
+	walk_state state;
+	int i;
+
+	state.mmap = mmap;
+	state.table = table;
+	get_disk_geometry(mmap, &state.geometry);
+	state.num_workers = num_workers;
+
+	// Every entry outside the root directory sits in an allocated cluster, which bounds the total
+	int used_clusters = 0;
+	for (i = 2; i < state.geometry.total_clusters + 2; i ++) {
+		used_clusters += (table->entries[i] != 0x00);
+	}
+	state.capacity = state.geometry.root_entries + (used_clusters * (state.geometry.bytes_per_cluster / 32));
+	state.entries = malloc(state.capacity * sizeof(walk_entry));
+	atomic_init(&state.num_entries, 0);
+	atomic_init(&state.num_skipped, 0);
+
+	int visited_words = (state.geometry.total_clusters + 2 + 63) / 64;
+	state.visited = malloc(visited_words * sizeof(atomic_uint_least64_t));
+	for (i = 0; i < visited_words; i ++) {
+		atomic_init(&state.visited[i], 0);
+	}
+
+	state.deques = malloc(num_workers * sizeof(walk_deque));
+	for (i = 0; i < num_workers; i ++) {
+		state.deques[i].capacity = 16;
+		state.deques[i].tasks = malloc(state.deques[i].capacity * sizeof(walk_task));
+		state.deques[i].top = 0;
+		state.deques[i].bottom = 0;
+		pthread_mutex_init(&state.deques[i].mutex, NULL);
+	}
+
+	// Start with the root directory on the first worker's deque
+	walk_task root = { 0, -1, 0 };
+	atomic_init(&state.pending, 1);
+	push_task(&state.deques[0], root);
+
+	// The calling thread is worker 0
+	walk_worker *workers = malloc(num_workers * sizeof(walk_worker));
+	pthread_t *threads = malloc(num_workers * sizeof(pthread_t));
+	for (i = 0; i < num_workers; i ++) {
+		workers[i].state = &state;
+		workers[i].id = i;
+		if (i > 0) {
+			pthread_create(&threads[i], NULL, walk_worker_function, &workers[i]);
+		}
+	}
+	walk_worker_function(&workers[0]);
+	for (i = 1; i < num_workers; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_workers; i ++) {
+		free(state.deques[i].tasks);
+		pthread_mutex_destroy(&state.deques[i].mutex);
+	}
+	free(state.deques);
+	free(state.visited);
+	free(workers);
+	free(threads);
+
+	int num_entries = atomic_load(&state.num_entries);
+	if (num_skipped != NULL) {
+		*num_skipped = atomic_load(&state.num_skipped);
+	}
+	*entries = state.entries;
+	return num_entries < state.capacity ? num_entries : state.capacity;
+}
+
+// Builds the full path of entries[index], e.g. /DOCS/NOTES.TXT, into path (WALK_PATH_MAX bytes). The walk only
+// records entries whose path fits, so the path is built back to front from the lengths it worked out.
+void get_walk_path(char *mmap, walk_entry *entries, int index, char *path) {
+	char name[13];
+
+	path[entries[index].path_length] = '\0';
+	while (index >= 0) {
+		int end = entries[index].path_length;
+		get_entry_name(mmap, name, entries[index].entry_offset);
+		int name_length = strlen(name);
+		memcpy(path + end - name_length, name, name_length);
+		path[end - name_length - 1] = '/';
+		index = entries[index].parent;
+	}
+}
+
+// Writes a line to out for every part of the tree the walk left out, with num_skipped as set by walk_directories.
+void print_skipped_directories(FILE *out, char *mmap, walk_entry *entries, int num_entries, int num_skipped, char *image_name) {
+	char path[WALK_PATH_MAX];
+	int i;
+
+	for (i = 0; i < num_entries; i ++) {
+		if (entries[i].skipped) {
+			get_walk_path(mmap, entries, i, path);
+			fprintf(out, "%s: %s: paths inside it would be longer than %d characters, its contents were skipped\n", image_name, path, WALK_PATH_MAX - 1);
+			num_skipped --;
+		}
+	}
+	if (num_skipped > 0) {
+		fprintf(out, "%s: %d directory entries were skipped because directories share clusters\n", image_name, num_skipped);
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef DIR_WALK_H_INCLUDED
+#define DIR_WALK_H_INCLUDED
+
+#include <stdio.h>
+#include "fat_table.h"
+
+// Longest path get_walk_path will build, including the terminating NUL
+#define WALK_PATH_MAX 260
+
+// One file or directory found by the walk. Entries of the root directory have parent -1; everything
+// else points at the walk_entry of the directory that holds it. path_length is the length of the entry's full
+// path, which always fits in WALK_PATH_MAX. skipped is set on a directory whose entries' paths might not fit, and
+// whose contents were therefore not walked.
+typedef struct {
+	long entry_offset;
+	int parent;
+	int path_length;
+	int skipped;
+} walk_entry;
+
+int walk_directories(char *mmap, fat_table *table, int num_workers, walk_entry **entries, int *num_skipped);
+void get_walk_path(char *mmap, walk_entry *entries, int index, char *path);
+void print_skipped_directories(FILE *out, char *mmap, walk_entry *entries, int num_entries, int num_skipped, char *image_name);
+
+#endif
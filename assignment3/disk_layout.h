@@ -0,0 +1,219 @@
+#ifndef DISK_LAYOUT_H_INCLUDED
+#define DISK_LAYOUT_H_INCLUDED
+
+// On-disk layout of a FAT12 image and allocation free accessors for its little endian fields.
+// Fields are read through memcpy so they work at any alignment, which the packed views below need.
+
+#include <stdint.h>
+#include <string.h> // memcpy, strlen
+#include <endian.h> // le16toh, le32toh
+
+// The boot sector and its BIOS Parameter Block, as laid out at byte 0 of the image
+typedef struct __attribute__((packed)) {
+	uint8_t jump[3];
+	char os_name[8];
+	uint16_t bytes_per_sector;
+	uint8_t sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint8_t total_fats;
+	uint16_t max_root_directory_entries;
+	uint16_t total_sectors;
+	uint8_t media_descriptor;
+	uint16_t sectors_per_fat;
+	uint16_t sectors_per_track;
+	uint16_t heads;
+	uint32_t hidden_sectors;
+	uint32_t total_sectors_large;
+	uint8_t drive_number;
+	uint8_t reserved;
+	uint8_t boot_signature;
+	uint32_t volume_id;
+	char volume_label[11];
+	char file_system_type[8];
+} boot_sector;
+
+// A 32 byte directory entry
+typedef struct __attribute__((packed)) {
+	char name[8];
+	char extension[3];
+	uint8_t attributes;
+	uint8_t reserved;
+	uint8_t creation_time_fine;
+	uint16_t creation_time;
+	uint16_t creation_date;
+	uint16_t last_access_date;
+	uint16_t high_first_cluster;
+	uint16_t last_write_time;
+	uint16_t last_write_date;
+	uint16_t first_cluster;
+	uint32_t file_size;
+} directory_entry;
+
+#define BOOT_SECTOR(mmap) ((boot_sector *) (mmap))
+#define DIRECTORY_ENTRY(mmap, offset) ((directory_entry *) ((mmap) + (offset)))
+
+static inline uint16_t read_le16(const void *field) {
+	uint16_t value;
+	memcpy(&value, field, sizeof(value));
+	return le16toh(value);
+}
+
+static inline uint32_t read_le32(const void *field) {
+	uint32_t value;
+	memcpy(&value, field, sizeof(value));
+	return le32toh(value);
+}
+
+static inline void write_le16(void *field, uint16_t value) {
+	value = htole16(value);
+	memcpy(field, &value, sizeof(value));
+}
+
+static inline void write_le32(void *field, uint32_t value) {
+	value = htole32(value);
+	memcpy(field, &value, sizeof(value));
+}
+
+static inline int get_bytes_per_sector(char *mmap) {
+	return read_le16(&BOOT_SECTOR(mmap)->bytes_per_sector);
+}
+
+static inline int get_sectors_per_cluster(char *mmap) {
+	return BOOT_SECTOR(mmap)->sectors_per_cluster;
+}
+
+static inline int get_total_fats(char *mmap) {
+	return BOOT_SECTOR(mmap)->total_fats;
+}
+
+static inline int get_max_root_directory_entries(char *mmap) {
+	return read_le16(&BOOT_SECTOR(mmap)->max_root_directory_entries);
+}
+
+static inline int get_reserved_sectors(char *mmap) {
+	return read_le16(&BOOT_SECTOR(mmap)->reserved_sectors);
+}
+
+static inline int get_total_sectors(char *mmap) {
+	// Volumes too big for the 16 bit count store 0 there and use the 32 bit count instead
+	int total_sectors = read_le16(&BOOT_SECTOR(mmap)->total_sectors);
+	return total_sectors != 0 ? total_sectors : (int) read_le32(&BOOT_SECTOR(mmap)->total_sectors_large);
+}
+
+static inline int get_sectors_per_fat(char *mmap) {
+	return read_le16(&BOOT_SECTOR(mmap)->sectors_per_fat);
+}
+
+// Turns the space padded 8.3 name of the entry at offset into NAME.EXT
+static inline void get_entry_name(char *mmap, char *file_name, long offset) {
+	int length = 0;
+	int i;
+	for (i = 0; i < 8 && mmap[offset + i] != ' '; i ++) {
+		file_name[length ++] = mmap[offset + i];
+	}
+	if (mmap[offset + 8] != ' ') {
+		file_name[length ++] = '.';
+		for (i = 0; i < 3 && mmap[offset + 8 + i] != ' '; i ++) {
+			file_name[length ++] = mmap[offset + 8 + i];
+		}
+	}
+	file_name[length] = '\0';
+}
+
+// Whether the used entry at offset names a file or directory: not deleted, not a long file name piece and not
+// the volume label
+static inline int is_named_entry(char *mmap, long offset) {
+	int attributeValue = mmap[offset + 11];
+	return (unsigned char) mmap[offset] != 0xE5 && (attributeValue & 0x0F) != 0x0F && (attributeValue & 0x08) != 0x08;
+}
+
+// Cuts the space padding off a name or label copied out of the disk
+static inline void trim_spaces(char *value) {
+	int i;
+	for (i = strlen(value) - 1; i >= 0 && value[i] == ' '; i --) {
+		value[i] = '\0';
+	}
+}
+
+// Where everything lives on the disk, worked out from the BPB. Sector numbers are physical; clusters are logical,
+// with logical cluster 2 being the first cluster of the data area.
+typedef struct {
+	int bytes_per_sector;
+	int sectors_per_cluster;
+	int bytes_per_cluster;
+	int total_fats;
+	int sectors_per_fat;
+	int total_sectors;
+	int first_fat_sector;
+	int first_root_sector;
+	int root_sectors;
+	int root_entries;
+	int first_data_sector;
+	int total_clusters;
+} disk_geometry;
+
+static inline void get_disk_geometry(char *mmap, disk_geometry *geometry) {
+	geometry->bytes_per_sector = get_bytes_per_sector(mmap);
+	geometry->sectors_per_cluster = get_sectors_per_cluster(mmap);
+	geometry->bytes_per_cluster = geometry->bytes_per_sector * geometry->sectors_per_cluster;
+	geometry->total_fats = get_total_fats(mmap);
+	geometry->sectors_per_fat = get_sectors_per_fat(mmap);
+	geometry->total_sectors = get_total_sectors(mmap);
+
+	// Reserved sectors (the boot sector at least), then the FATs, then the root directory, then the data area
+	geometry->first_fat_sector = get_reserved_sectors(mmap);
+	geometry->first_root_sector = geometry->first_fat_sector + (geometry->total_fats * geometry->sectors_per_fat);
+	geometry->root_entries = get_max_root_directory_entries(mmap);
+	geometry->root_sectors = ((geometry->root_entries * 32) + geometry->bytes_per_sector - 1) / geometry->bytes_per_sector;
+	geometry->first_data_sector = geometry->first_root_sector + geometry->root_sectors;
+	geometry->total_clusters = (geometry->total_sectors - geometry->first_data_sector) / geometry->sectors_per_cluster;
+
+	// Never hand out a cluster the FAT has no entry for
+	int fat_entries = (geometry->sectors_per_fat * geometry->bytes_per_sector * 2) / 3;
+	if (geometry->total_clusters > fat_entries - 2) {
+		geometry->total_clusters = fat_entries - 2;
+	}
+}
+
+// Byte offset of the first byte of a logical cluster
+static inline long get_cluster_offset(disk_geometry *geometry, int cluster) {
+	return (long) (geometry->first_data_sector + ((cluster - 2) * geometry->sectors_per_cluster)) * geometry->bytes_per_sector;
+}
+
+// Byte offset of entry number index of the root directory
+static inline long get_root_entry_offset(disk_geometry *geometry, int index) {
+	return ((long) geometry->first_root_sector * geometry->bytes_per_sector) + (index * 32);
+}
+
+// Byte offset of the root directory entry holding the volume label, or -1 if there is none
+static inline long get_volume_label_offset(char *mmap, disk_geometry *geometry) {
+	int i;
+	for (i = 0; i < geometry->root_entries; i ++) {
+		long offset = get_root_entry_offset(geometry, i);
+		int attributeValue = mmap[offset + 11];
+		if ((attributeValue & 0x08) == 0x08 && (attributeValue & 0x0F) != 0x0F) {
+			return offset;
+		}
+	}
+	return -1;
+}
+
+// Rejects files that can't be a FAT12 image before any offsets are taken from their boot sector.
+static inline int is_fat12_image(char *mmap, long size) {
+	if (size < 512) {
+		return 0;
+	}
+
+	// Check the fields the geometry divides by before working it out
+	int bytes_per_sector = get_bytes_per_sector(mmap);
+	if (bytes_per_sector < 512 || (bytes_per_sector & (bytes_per_sector - 1)) != 0 || get_sectors_per_cluster(mmap) == 0) {
+		return 0;
+	}
+
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	return (long) geometry.first_data_sector * geometry.bytes_per_sector <= size
+		&& (long) geometry.total_sectors * geometry.bytes_per_sector <= size;
+}
+
+#endif
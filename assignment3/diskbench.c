@@ -0,0 +1,539 @@
+// Benchmarks the disk tools on generated images.
+// Invoked as follows: ./diskbench [-t milliseconds per benchmark]
+//
+// Two 1.44 MB images are generated with the same files in them: a dense one where every chain is one
+// contiguous run, and a fragmented one where the clusters of all the files and directories are dealt out
+// round robin so no chain has two neighbouring clusters. Each benchmark calls the tool's own code in a loop
+// for at least the given time and reports the time per operation, the throughput where data moves, and the
+// number of malloc, calloc and realloc calls per operation (counted by wrapping them at link time).
+//
+// free space   fat12_statfs, everything diskinfo reports including the free space
+// list root    the root directory listing of disklist
+// list tree    the disklist -r listing of the whole tree, and of a third image nested deeper than every path
+//              can fit, which is first checked to list exactly what fits and count the rest as skipped
+// get          copy_file_out of every root file to /dev/null, one operation per file
+// put          put_files of a directory of files into an empty image, one operation per file, including the
+//              commit and its syncs
+//
+// A benchmark whose operations report an error is printed as failed, and diskbench then exits with 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>  // mmap
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include <string.h>
+#include <time.h> // clock_gettime
+#include <stdatomic.h>
+#include "diskbench.h"
+
+#define BENCH_PUT_FILES 32
+#define BENCH_PUT_SIZE 16384
+#define BENCH_DEEP_DIRS 30
+
+static atomic_long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_realloc(pointer, size);
+}
+
+static long now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (time.tv_sec * 1000000000L) + time.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	long min_milliseconds = 200;
+	int option;
+
+	while ((option = getopt(argc, argv, "t:")) != -1) {
+		if (option == 't') {
+			min_milliseconds = atol(optarg);
+		} else {
+			min_milliseconds = 0;
+		}
+	}
+
+	if(argc != optind || min_milliseconds < 1)
+	{
+		fprintf(stderr, "Usage: diskbench [-t milliseconds per benchmark]\n");
+		return -1;
+	}
+	long min_nanoseconds = min_milliseconds * 1000000L;
+
+	char workspace[] = "/tmp/diskbench.XXXXXX";
+	if (mkdtemp(workspace) == NULL) {
+		perror("Error creating workspace");
+		exit(EXIT_FAILURE);
+	}
+
+	char *names[] = { "dense", "fragmented" };
+	char path[64];
+	int failures = 0;
+	int i;
+
+	printf("%-12s %-11s %12s %10s %10s\n", "benchmark", "image", "ns/op", "MB/s", "allocs/op");
+	for (i = 0; i < 2; i ++) {
+		sprintf(path, "%s/%s.IMA", workspace, names[i]);
+		if (make_image(path, 100, 16, 32, 4096, i, 0) < 0) {
+			perror("Error generating image");
+			exit(EXIT_FAILURE);
+		}
+
+		int fd = open(path, O_RDONLY);
+		struct stat file_stats;
+		fstat(fd, &file_stats);
+		char *map = mmap(NULL, file_stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		bench_result result = bench_free_space(map, min_nanoseconds);
+		failures += print_result("free space", names[i], &result);
+		result = bench_listing(map, 0, min_nanoseconds);
+		failures += print_result("list root", names[i], &result);
+		result = bench_listing(map, 1, min_nanoseconds);
+		failures += print_result("list tree", names[i], &result);
+		result = bench_get(map, min_nanoseconds);
+		failures += print_result("get", names[i], &result);
+
+		munmap(map, file_stats.st_size);
+		close(fd);
+		unlink(path);
+	}
+
+	// A chain of directories too deep for every path to fit, listed only once the walk is known to get it right
+	sprintf(path, "%s/deep.IMA", workspace);
+	if (make_image(path, 0, BENCH_DEEP_DIRS, 1, 512, 0, 1) < 0) {
+		perror("Error generating image");
+		exit(EXIT_FAILURE);
+	}
+	int deep_fd = open(path, O_RDONLY);
+	struct stat deep_stats;
+	fstat(deep_fd, &deep_stats);
+	char *deep_map = mmap(NULL, deep_stats.st_size, PROT_READ, MAP_SHARED, deep_fd, 0);
+	if (check_deep_listing(deep_map) < 0) {
+		exit(EXIT_FAILURE);
+	}
+	bench_result deep_result = bench_listing(deep_map, 1, min_nanoseconds);
+	failures += print_result("list tree", "deep", &deep_result);
+	munmap(deep_map, deep_stats.st_size);
+	close(deep_fd);
+	unlink(path);
+
+	sprintf(path, "%s/empty.IMA", workspace);
+	if (make_image(path, 0, 0, 0, 0, 0, 0) < 0) {
+		perror("Error generating image");
+		exit(EXIT_FAILURE);
+	}
+	bench_result result = bench_put(workspace, path, min_nanoseconds);
+	failures += print_result("put", "empty", &result);
+	unlink(path);
+	rmdir(workspace);
+	return failures > 0 ? EXIT_FAILURE : 0;
+}
+
+// Prints one row of the table. Returns 1 if the benchmark failed, or 0.
+int print_result(char *name, char *image, bench_result *result) {
+	if (result->failed || result->ops == 0) {
+		printf("%-12s %-11s %12s\n", name, image, result->failed ? "failed" : "no ops");
+		return result->failed;
+	}
+
+	double ns_per_op = (double) result->nanoseconds / result->ops;
+	printf("%-12s %-11s %12.1f ", name, image, ns_per_op);
+	if (result->bytes > 0) {
+		printf("%10.1f ", ((double) result->bytes / (1024 * 1024)) / ((double) result->nanoseconds / 1000000000L));
+	} else {
+		printf("%10s ", "-");
+	}
+	printf("%10.1f\n", (double) result->allocations / result->ops);
+	return 0;
+}
+
+// Cheap repeatable random numbers, so both images get the same files on every run
+static unsigned int next_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void write_entry(char *entry_bytes, const char *name, int attributes, int first_cluster, int size) {
+	directory_entry *entry = (directory_entry *) entry_bytes;
+
+	// Everything is dated 2010-06-15 12:30
+	int date = 15 + (6 << 5) + ((2010 - 1980) << 9);
+	int time = (30 << 5) + (12 << 11);
+
+	memset(entry, 0, sizeof(directory_entry));
+	memcpy(entry->name, name, 11);
+	entry->attributes = attributes;
+	write_le16(&entry->creation_time, time);
+	write_le16(&entry->creation_date, date);
+	write_le16(&entry->last_access_date, date);
+	write_le16(&entry->last_write_time, time);
+	write_le16(&entry->last_write_date, date);
+	write_le16(&entry->first_cluster, first_cluster);
+	write_le32(&entry->file_size, size);
+}
+
+// Writes a 1.44 MB image to path holding root_files files and num_dirs directories of files_per_dir files
+// each, every file between 1 and max_file_size bytes. The directories all sit in the root, or if nested each one
+// sits in the one before, with 8.3 names as long as they get. Returns 0, or -1 if they don't fit or on a write
+// error.
+int make_image(char *path, int root_files, int num_dirs, int files_per_dir, int max_file_size, int fragmented, int nested) {
+	long image_size = 2880 * 512;
+	char *image = calloc(image_size, 1);
+	boot_sector *boot = BOOT_SECTOR(image);
+	int i;
+
+	memcpy(boot->jump, "\xEB\x3C\x90", 3);
+	memcpy(boot->os_name, "DISKBNCH", 8);
+	write_le16(&boot->bytes_per_sector, 512);
+	boot->sectors_per_cluster = 1;
+	write_le16(&boot->reserved_sectors, 1);
+	boot->total_fats = 2;
+	write_le16(&boot->max_root_directory_entries, 224);
+	write_le16(&boot->total_sectors, 2880);
+	boot->media_descriptor = 0xF0;
+	write_le16(&boot->sectors_per_fat, 9);
+	write_le16(&boot->sectors_per_track, 18);
+	write_le16(&boot->heads, 2);
+	boot->boot_signature = 0x29;
+	memcpy(boot->volume_label, "BENCH      ", 11);
+	memcpy(boot->file_system_type, "FAT12   ", 8);
+	image[510] = 0x55;
+	image[511] = (char) 0xAA;
+
+	disk_geometry geometry;
+	get_disk_geometry(image, &geometry);
+
+	// The root directory's objects first, then each directory's files
+	int num_objects = root_files + num_dirs + (num_dirs * files_per_dir);
+	bench_object *objects = calloc(num_objects + 1, sizeof(bench_object));
+	unsigned int random_state = 2463534242u;
+	int total_clusters = 0;
+	int n = 0;
+	for (i = 0; i < root_files + num_dirs; i ++, n ++) {
+		objects[n].parent = nested && i > root_files ? n - 1 : -1;
+		objects[n].is_directory = i >= root_files;
+		if (objects[n].is_directory && nested) {
+			snprintf(objects[n].name, sizeof(objects[n].name), "DIRS%04uEXT", (unsigned int) (i - root_files) % 10000);
+		} else if (objects[n].is_directory) {
+			snprintf(objects[n].name, sizeof(objects[n].name), "DIR%04u    ", (unsigned int) (i - root_files) % 10000);
+		} else {
+			snprintf(objects[n].name, sizeof(objects[n].name), "ROOT%04uBIN", (unsigned int) i % 10000);
+		}
+	}
+	for (i = 0; i < num_dirs * files_per_dir; i ++, n ++) {
+		objects[n].parent = root_files + (i / files_per_dir);
+		snprintf(objects[n].name, sizeof(objects[n].name), "FILE%04uBIN", (unsigned int) (i % files_per_dir) % 10000);
+	}
+	for (i = 0; i < num_objects; i ++) {
+		if (objects[i].is_directory) {
+			objects[i].num_clusters = (((2 + files_per_dir + nested) * 32) + geometry.bytes_per_cluster - 1) / geometry.bytes_per_cluster;
+		} else {
+			objects[i].size = 1 + (next_random(&random_state) % max_file_size);
+			objects[i].num_clusters = (objects[i].size + geometry.bytes_per_cluster - 1) / geometry.bytes_per_cluster;
+		}
+		objects[i].clusters = malloc((objects[i].num_clusters + 1) * sizeof(int));
+		total_clusters += objects[i].num_clusters;
+	}
+
+	// The volume label takes one of the root directory's entries
+	int root_objects = root_files + (nested ? (num_dirs > 0) : num_dirs);
+	if (total_clusters > geometry.total_clusters || root_objects > geometry.root_entries - 1) {
+		for (i = 0; i < num_objects; i ++) {
+			free(objects[i].clusters);
+		}
+		free(objects);
+		free(image);
+		return -1;
+	}
+
+	// Dense images take each chain in one run; fragmented ones deal one cluster to every unfinished chain in turn
+	int next_cluster = 2;
+	if (fragmented) {
+		int round;
+		for (round = 0; next_cluster < total_clusters + 2; round ++) {
+			for (i = 0; i < num_objects; i ++) {
+				if (round < objects[i].num_clusters) {
+					objects[i].clusters[round] = next_cluster ++;
+				}
+			}
+		}
+	} else {
+		for (i = 0; i < num_objects; i ++) {
+			int j;
+			for (j = 0; j < objects[i].num_clusters; j ++) {
+				objects[i].clusters[j] = next_cluster ++;
+			}
+		}
+	}
+
+	fat_table table;
+	table.num_entries = (geometry.sectors_per_fat * geometry.bytes_per_sector * 2) / 3;
+	table.entries = calloc(table.num_entries, sizeof(uint16_t));
+	table.entries[0] = 0xFF0;
+	table.entries[1] = 0xFFF;
+
+	int root_index = 0;
+	int *directory_index = calloc(num_objects + 1, sizeof(int));
+	char *root = image + ((long) geometry.first_root_sector * geometry.bytes_per_sector);
+	write_entry(root + (32 * root_index ++), "BENCH      ", 0x08, 0, 0);
+
+	for (i = 0; i < num_objects; i ++) {
+		bench_object *object = &objects[i];
+		int first_cluster = object->num_clusters > 0 ? object->clusters[0] : 0;
+		int j;
+
+		for (j = 0; j < object->num_clusters; j ++) {
+			table.entries[object->clusters[j]] = j + 1 < object->num_clusters ? object->clusters[j + 1] : 0xFFF;
+		}
+
+		// Find the entry in the parent, which is laid out through the parent's own chain
+		char *entry;
+		if (object->parent < 0) {
+			entry = root + (32 * root_index ++);
+		} else {
+			bench_object *parent = &objects[object->parent];
+			long position = (long) (directory_index[object->parent] ++) * 32;
+			entry = image + get_cluster_offset(&geometry, parent->clusters[position / geometry.bytes_per_cluster]) + (position % geometry.bytes_per_cluster);
+		}
+		write_entry(entry, object->name, object->is_directory ? 0x10 : 0x00, first_cluster, object->size);
+
+		if (object->is_directory) {
+			char *first = image + get_cluster_offset(&geometry, first_cluster);
+			write_entry(first, ".          ", 0x10, first_cluster, 0);
+			write_entry(first + 32, "..         ", 0x10, 0, 0);
+			directory_index[i] = 2;
+		} else {
+			// Fill the file with bytes that depend on both the file and the position
+			int done;
+			for (done = 0; done < object->size; done ++) {
+				image[get_cluster_offset(&geometry, object->clusters[done / geometry.bytes_per_cluster]) + (done % geometry.bytes_per_cluster)] = (char) (i + (done * 7));
+			}
+		}
+	}
+
+	char *first_fat = image + ((long) geometry.first_fat_sector * geometry.bytes_per_sector);
+	pack_fat_entries(table.entries, (unsigned char *) first_fat, table.num_entries);
+	memcpy(first_fat + (geometry.sectors_per_fat * geometry.bytes_per_sector), first_fat, geometry.sectors_per_fat * geometry.bytes_per_sector);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int written = fd >= 0 ? write(fd, image, image_size) : -1;
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	for (i = 0; i < num_objects; i ++) {
+		free(objects[i].clusters);
+	}
+	free(objects);
+	free(directory_index);
+	free(table.entries);
+	free(image);
+	return written == image_size ? 0 : -1;
+}
+
+bench_result bench_free_space(char *map, long min_nanoseconds) {
+	bench_result result = { 0, 0, 0, 0, 0 };
+	long allocations_before = atomic_load(&allocations);
+	long start = now();
+
+	do {
+		fat12_image image;
+		fat12_info info;
+		fat12_attach(&image, map);
+		fat12_statfs(&image, &info);
+		fat12_detach(&image);
+		result.ops ++;
+		result.nanoseconds = now() - start;
+	} while (result.nanoseconds < min_nanoseconds);
+
+	result.allocations = atomic_load(&allocations) - allocations_before;
+	return result;
+}
+
+bench_result bench_listing(char *map, int tree, long min_nanoseconds) {
+	bench_result result = { 0, 0, 0, 0, 0 };
+	long allocations_before = atomic_load(&allocations);
+	long start = now();
+
+	do {
+		int num_files;
+		int num_skipped;
+		file_struct *files;
+
+		// disklist decodes the FAT once per invocation, so that is counted in every listing
+		fat12_image image;
+		fat12_attach(&image, map);
+		if (tree) {
+			files = get_files_in_tree(&image, "generated image", NULL, 1, &num_files, &num_skipped);
+		} else {
+			files = get_files_in_root(&image, &num_files);
+		}
+		fat12_detach(&image);
+		free(files);
+		result.ops ++;
+		result.nanoseconds = now() - start;
+	} while (result.nanoseconds < min_nanoseconds);
+
+	result.allocations = atomic_load(&allocations) - allocations_before;
+	return result;
+}
+
+// Checks the tree listing of the image make_image nests BENCH_DEEP_DIRS directories deep in. Every name in it is
+// twelve characters, so a directory at level k has a path 13 * k long and is walked into only if its entries'
+// paths fit in WALK_PATH_MAX. Exactly the directories and files down to there must be listed, each with its
+// whole path, and the first directory left unwalked must be counted as skipped. Returns 0, or -1 after saying
+// what was wrong.
+int check_deep_listing(char *map) {
+	int walked_levels = 0;
+	while (walked_levels < BENCH_DEEP_DIRS && (13 * (walked_levels + 1)) + 13 < WALK_PATH_MAX) {
+		walked_levels ++;
+	}
+	int expected_files = (2 * walked_levels) + (walked_levels < BENCH_DEEP_DIRS);
+	int expected_skipped = walked_levels < BENCH_DEEP_DIRS;
+
+	int num_files;
+	int num_skipped;
+	int failed = 0;
+	int i;
+	fat12_image image;
+	fat12_attach(&image, map);
+	file_struct *files = get_files_in_tree(&image, "deep image", NULL, 1, &num_files, &num_skipped);
+	fat12_detach(&image);
+	if (num_files != expected_files || num_skipped != expected_skipped) {
+		fprintf(stderr, "deep image: listed %d entries and skipped %d, expected %d and %d\n", num_files, num_skipped, expected_files, expected_skipped);
+		failed = 1;
+	}
+	for (i = 0; i < num_files && !failed; i ++) {
+		int levels = 0;
+		char *slash;
+		for (slash = strchr(files[i].file_name, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+			levels ++;
+		}
+		if ((int) strlen(files[i].file_name) != 13 * levels) {
+			fprintf(stderr, "deep image: %s is not a whole path\n", files[i].file_name);
+			failed = 1;
+		}
+	}
+
+	free(files);
+	return failed ? -1 : 0;
+}
+
+bench_result bench_get(char *map, long min_nanoseconds) {
+	bench_result result = { 0, 0, 0, 0, 0 };
+	disk_geometry geometry;
+	get_disk_geometry(map, &geometry);
+	int out_fd = open("/dev/null", O_WRONLY);
+
+	// diskget loads the table once per invocation, so that is counted once per pass over the files
+	long allocations_before = atomic_load(&allocations);
+	long start = now();
+	do {
+		fat12_image image;
+		fat12_attach(&image, map);
+		int i;
+		for (i = 0; i < geometry.root_entries; i ++) {
+			long offset = get_root_entry_offset(&geometry, i);
+			directory_entry *entry = DIRECTORY_ENTRY(map, offset);
+			if (map[offset] == 0x00) {
+				break;
+			}
+			if ((unsigned char) map[offset] == 0xE5 || (entry->attributes & 0x18) != 0) {
+				continue;
+			}
+
+			if (copy_file_out(&image, offset, out_fd) < 0) {
+				perror("get");
+				result.failed = 1;
+				break;
+			}
+			result.bytes += read_le32(&entry->file_size);
+			result.ops ++;
+		}
+		fat12_detach(&image);
+		result.nanoseconds = now() - start;
+	} while (result.nanoseconds < min_nanoseconds && result.ops > 0 && !result.failed);
+
+	result.allocations = atomic_load(&allocations) - allocations_before;
+	close(out_fd);
+	return result;
+}
+
+bench_result bench_put(char *workspace, char *empty_image, long min_nanoseconds) {
+	bench_result result = { 0, 0, 0, 0, 0 };
+	char *files[BENCH_PUT_FILES];
+	char image[64];
+	char *data = malloc(BENCH_PUT_SIZE);
+	int i;
+
+	// The files to put, and a copy of the empty image to put them in before every pass
+	sprintf(image, "%s/put.IMA", workspace);
+	for (i = 0; i < BENCH_PUT_FILES; i ++) {
+		files[i] = malloc(strlen(workspace) + 16);
+		sprintf(files[i], "%s/PUT%d.BIN", workspace, i);
+		memset(data, i, BENCH_PUT_SIZE);
+		int fd = open(files[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write(fd, data, BENCH_PUT_SIZE) != BENCH_PUT_SIZE) {
+			perror("Error writing put source");
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+
+	int empty_fd = open(empty_image, O_RDONLY);
+	struct stat empty_stats;
+	fstat(empty_fd, &empty_stats);
+	char *empty = mmap(NULL, empty_stats.st_size, PROT_READ, MAP_SHARED, empty_fd, 0);
+
+	do {
+		int fd = open(image, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write(fd, empty, empty_stats.st_size) != empty_stats.st_size) {
+			perror("Error resetting put image");
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+
+		long allocations_before = atomic_load(&allocations);
+		long start = now();
+		if (put_files(image, files, BENCH_PUT_FILES, 0, 1) != 0) {
+			result.failed = 1;
+			break;
+		}
+		result.nanoseconds += now() - start;
+		result.allocations += atomic_load(&allocations) - allocations_before;
+		result.ops += BENCH_PUT_FILES;
+		result.bytes += (long) BENCH_PUT_FILES * BENCH_PUT_SIZE;
+	} while (result.nanoseconds < min_nanoseconds);
+
+	munmap(empty, empty_stats.st_size);
+	close(empty_fd);
+	unlink(image);
+	for (i = 0; i < BENCH_PUT_FILES; i ++) {
+		unlink(files[i]);
+		free(files[i]);
+	}
+	free(data);
+	return result;
+}
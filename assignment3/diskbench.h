@@ -0,0 +1,41 @@
+#ifndef DISKBENCH_H_INCLUDED
+#define DISKBENCH_H_INCLUDED
+
+#include "disk_layout.h"
+#include "fat_table.h"
+#include "fat12.h"
+#include "list_files.h"
+#include "get_files.h"
+#include "put_files.h"
+#include "dir_walk.h"
+
+// One file or directory of a generated image
+typedef struct {
+	int parent;
+	int is_directory;
+	int size;
+	char name[12];
+	int num_clusters;
+	int *clusters;
+} bench_object;
+
+// The result of timing one operation over and over
+typedef struct {
+	long ops;
+	long nanoseconds;
+	long bytes;
+	long allocations;
+
+	// Set when the tool's code reported an error, which makes the timing meaningless
+	int failed;
+} bench_result;
+
+int make_image(char *path, int root_files, int num_dirs, int files_per_dir, int max_file_size, int fragmented, int nested);
+int check_deep_listing(char *map);
+int print_result(char *name, char *image, bench_result *result);
+bench_result bench_free_space(char *map, long min_nanoseconds);
+bench_result bench_listing(char *map, int tree, long min_nanoseconds);
+bench_result bench_get(char *map, long min_nanoseconds);
+bench_result bench_put(char *workspace, char *empty_image, long min_nanoseconds);
+
+#endif
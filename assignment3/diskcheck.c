@@ -0,0 +1,396 @@
+// Checks a file system image for consistency.
+// Invoked as follows: ./diskcheck [-j workers] disk.IMA
+//
+// Reports:
+// - FAT copies that don't agree with the first one
+// - cluster chains that run outside the data area, into a free cluster or into a bad cluster
+// - clusters claimed by more than one chain (cross-linked)
+// - files whose size doesn't match the length of their chain
+// - lost clusters: allocated in the FAT but not part of any chain
+// - directories nested too deep to walk into, whose contents go unchecked
+//
+// Each check is split across the workers by cluster (or entry) range. Chains claim their clusters in a
+// shared bitmap with an atomic or, so a second claim on a cluster shows up as a cross-link without any
+// locking. Exits with 0 if the image is clean and 1 if anything was found. If part of the tree couldn't be walked,
+// the lost cluster check is left out, since the clusters of the skipped part would look lost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>  // mmap
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include <pthread.h>
+#include "diskcheck.h"
+
+typedef struct {
+	check_state *state;
+	int worker;
+	int start;
+	int end;
+	void (*work)(check_state *state, int worker, int start, int end);
+} check_task;
+
+int main(int argc, char *argv[])
+{
+	int num_workers = get_default_workers();
+	int option;
+
+	while ((option = getopt(argc, argv, "j:")) != -1) {
+		if (option == 'j') {
+			num_workers = atoi(optarg);
+		} else {
+			num_workers = 0;
+		}
+	}
+
+	if(argc - optind != 1 || num_workers < 1)
+	{
+		fprintf(stderr, "Usage: diskcheck [-j workers] <file system image>\n");
+		return -1;
+	}
+
+	char *file_system_image = argv[optind];
+
+	int fd;
+	struct stat file_stats;
+	char *map;
+
+	if ((fd = open(file_system_image, O_RDONLY)) < 0) {
+		perror("Error opening file for reading");
+		exit(EXIT_FAILURE);
+	}
+
+	// Return information about the file and store it in file_stats
+	fstat(fd, &file_stats);
+
+	// void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+	map = mmap(NULL, file_stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Error mapping file system image");
+		exit(EXIT_FAILURE);
+	}
+	if (!is_fat12_image(map, file_stats.st_size)) {
+		fprintf(stderr, "%s: Not a FAT12 image\n", file_system_image);
+		exit(EXIT_FAILURE);
+	}
+
+	check_state state;
+	int i;
+	state.mmap = map;
+	get_disk_geometry(map, &state.geometry);
+	state.table = load_fat_table(map);
+	state.num_workers = num_workers;
+	state.worker_problems = calloc(num_workers, sizeof(problem_list));
+
+	// Decode every FAT copy so they can be compared entry by entry
+	int fat_size = state.geometry.sectors_per_fat * state.geometry.bytes_per_sector;
+	state.fat_copies = malloc(state.geometry.total_fats * sizeof(uint16_t *));
+	for (i = 0; i < state.geometry.total_fats; i ++) {
+		state.fat_copies[i] = malloc(state.table->num_entries * sizeof(uint16_t));
+		unpack_fat_entries((unsigned char *) map + ((long) state.geometry.first_fat_sector * state.geometry.bytes_per_sector) + ((long) i * fat_size),
+			state.fat_copies[i], state.table->num_entries);
+	}
+	run_in_parallel(&state, state.table->num_entries, compare_fat_copies);
+
+	int num_skipped;
+	state.num_entries = walk_directories(map, state.table, num_workers, &state.entries, &num_skipped);
+	print_skipped_directories(stderr, map, state.entries, state.num_entries, num_skipped, file_system_image);
+
+	int bitmap_words = (state.geometry.total_clusters + 2 + 63) / 64;
+	state.claimed = malloc(bitmap_words * sizeof(atomic_uint_least64_t));
+	state.cross_linked = malloc(bitmap_words * sizeof(atomic_uint_least64_t));
+	for (i = 0; i < bitmap_words; i ++) {
+		atomic_init(&state.claimed[i], 0);
+		atomic_init(&state.cross_linked[i], 0);
+	}
+
+	run_in_parallel(&state, state.num_entries, check_chains);
+	if (num_skipped == 0) {
+		run_in_parallel(&state, state.geometry.total_clusters + 2, check_lost_clusters);
+	}
+	name_cross_links(&state);
+
+	problem *problems;
+	int num_problems = merge_problems(&state, &problems);
+	for (i = 0; i < num_problems; i ++) {
+		print_problem(&state, &problems[i]);
+	}
+
+	if (num_skipped > 0) {
+		printf("The directory tree could not be walked completely, so lost clusters were not checked\n");
+	}
+	if (num_problems == 0 && num_skipped == 0) {
+		printf("No problems found\n");
+	} else if (num_problems == 0) {
+		printf("No problems found in the part of the tree that was checked\n");
+	} else {
+		printf("%d problem%s found\n", num_problems, num_problems == 1 ? "" : "s");
+	}
+
+	free(problems);
+	for (i = 0; i < num_workers; i ++) {
+		free(state.worker_problems[i].problems);
+	}
+	free(state.worker_problems);
+	for (i = 0; i < state.geometry.total_fats; i ++) {
+		free(state.fat_copies[i]);
+	}
+	free(state.fat_copies);
+	free(state.claimed);
+	free(state.cross_linked);
+	free(state.entries);
+	free_fat_table(state.table);
+	munmap(map, file_stats.st_size);
+	close(fd);
+	return num_problems == 0 && num_skipped == 0 ? 0 : 1;
+}
+
+static void *check_worker_function(void *pointer) {
+	check_task *task = (check_task *) pointer;
+	task->work(task->state, task->worker, task->start, task->end);
+	return (void *) 0;
+}
+
+// Splits 0 to total into one contiguous range per worker and runs work on each of them.
+void run_in_parallel(check_state *state, int total, void (*work)(check_state *state, int worker, int start, int end)) {
+	check_task *tasks = malloc(state->num_workers * sizeof(check_task));
+	pthread_t *threads = malloc(state->num_workers * sizeof(pthread_t));
+	int i;
+
+	for (i = 0; i < state->num_workers; i ++) {
+		tasks[i].state = state;
+		tasks[i].worker = i;
+		tasks[i].start = (int) (((long) total * i) / state->num_workers);
+		tasks[i].end = (int) (((long) total * (i + 1)) / state->num_workers);
+		tasks[i].work = work;
+		if (i > 0) {
+			pthread_create(&threads[i], NULL, check_worker_function, &tasks[i]);
+		}
+	}
+
+	// The calling thread takes the first range
+	check_worker_function(&tasks[0]);
+	for (i = 1; i < state->num_workers; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(tasks);
+	free(threads);
+}
+
+// Reports the first entry in the range where each FAT copy differs from the first, with the number of differences.
+void compare_fat_copies(check_state *state, int worker, int start, int end) {
+	int copy;
+	for (copy = 1; copy < state->geometry.total_fats; copy ++) {
+		int first_difference = -1;
+		int differences = 0;
+		int i;
+		for (i = start; i < end; i ++) {
+			if (state->fat_copies[copy][i] != state->fat_copies[0][i]) {
+				if (first_difference < 0) {
+					first_difference = i;
+				}
+				differences ++;
+			}
+		}
+
+		if (differences > 0) {
+			add_problem(&state->worker_problems[worker], PROBLEM_FAT_MISMATCH, first_difference, copy, 0, differences);
+		}
+	}
+}
+
+// Follows the chain of every entry in the range, claiming each cluster on the way.
+void check_chains(check_state *state, int worker, int start, int end) {
+	disk_geometry *geometry = &state->geometry;
+	problem_list *problems = &state->worker_problems[worker];
+	int i;
+
+	for (i = start; i < end; i ++) {
+		directory_entry *entry = DIRECTORY_ENTRY(state->mmap, state->entries[i].entry_offset);
+		int is_directory = (entry->attributes & 0x10) == 0x10;
+		long file_size = read_le32(&entry->file_size);
+		int cluster = read_le16(&entry->first_cluster);
+		int length = 0;
+		int complete = (cluster == 0);
+
+		// An empty file has no chain at all
+		while (cluster != 0) {
+			if (cluster < 2 || cluster >= geometry->total_clusters + 2) {
+				add_problem(problems, PROBLEM_BAD_CHAIN, cluster, i, 0, 0);
+				break;
+			}
+
+			int value = state->table->entries[cluster];
+			if (value == 0x00 || value == 0xFF7) {
+				add_problem(problems, PROBLEM_BAD_CHAIN, cluster, i, value, 0);
+				break;
+			}
+
+			// A second claim is a cross-link, whether with another chain or with this one looping back on itself
+			uint_least64_t bit = (uint_least64_t) 1 << (cluster % 64);
+			if ((atomic_fetch_or(&state->claimed[cluster / 64], bit) & bit) != 0) {
+				atomic_fetch_or(&state->cross_linked[cluster / 64], bit);
+				break;
+			}
+
+			length ++;
+			if (value >= 0xFF8) {
+				complete = 1;
+				break;
+			}
+			cluster = value;
+		}
+
+		// Only a chain that ended properly has a length worth comparing; the others are already reported
+		int expected = (int) ((file_size + geometry->bytes_per_cluster - 1) / geometry->bytes_per_cluster);
+		if (!is_directory && complete && length != expected) {
+			add_problem(problems, PROBLEM_SIZE_MISMATCH, 0, i, expected, length);
+		}
+	}
+}
+
+// Reports runs of clusters in the range that are allocated but were not claimed by any chain.
+void check_lost_clusters(check_state *state, int worker, int start, int end) {
+	int run_start = -1;
+	int cluster;
+
+	if (start < 2) {
+		start = 2;
+	}
+	for (cluster = start; cluster <= end; cluster ++) {
+		int lost = 0;
+		if (cluster < end) {
+			int value = state->table->entries[cluster];
+			uint_least64_t bit = (uint_least64_t) 1 << (cluster % 64);
+			lost = value != 0x00 && value != 0xFF7 && (atomic_load(&state->claimed[cluster / 64]) & bit) == 0;
+		}
+
+		if (lost && run_start < 0) {
+			run_start = cluster;
+		} else if (!lost && run_start >= 0) {
+			add_problem(&state->worker_problems[worker], PROBLEM_LOST_CLUSTERS, run_start, -1, 0, cluster - run_start);
+			run_start = -1;
+		}
+	}
+}
+
+// Walks the chains again, serially, to report which entries share each cross-linked cluster.
+void name_cross_links(check_state *state) {
+	int bitmap_words = (state->geometry.total_clusters + 2 + 63) / 64;
+	int i;
+	for (i = 0; i < bitmap_words && atomic_load(&state->cross_linked[i]) == 0; i ++);
+	if (i == bitmap_words) {
+		return;
+	}
+
+	for (i = 0; i < state->num_entries; i ++) {
+		int cluster = read_le16(&DIRECTORY_ENTRY(state->mmap, state->entries[i].entry_offset)->first_cluster);
+		int steps;
+		for (steps = 0; cluster >= 2 && cluster < state->geometry.total_clusters + 2 && steps < state->geometry.total_clusters; steps ++) {
+			uint_least64_t bit = (uint_least64_t) 1 << (cluster % 64);
+			if ((atomic_load(&state->cross_linked[cluster / 64]) & bit) != 0) {
+				// Report each entry once per chain, at the first shared cluster
+				add_problem(&state->worker_problems[0], PROBLEM_CROSS_LINK, cluster, i, 0, 0);
+				break;
+			}
+			cluster = state->table->entries[cluster];
+		}
+	}
+}
+
+void add_problem(problem_list *list, int kind, int cluster, int entry, int expected, int actual) {
+	if (list->num_problems == list->capacity) {
+		list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+		list->problems = realloc(list->problems, list->capacity * sizeof(problem));
+	}
+
+	problem *added = &list->problems[list->num_problems ++];
+	added->kind = kind;
+	added->cluster = cluster;
+	added->entry = entry;
+	added->expected = expected;
+	added->actual = actual;
+}
+
+static int compare_problems(const void *a, const void *b) {
+	const problem *problemA = (const problem *) a;
+	const problem *problemB = (const problem *) b;
+
+	if (problemA->kind != problemB->kind) return problemA->kind - problemB->kind;
+	if (problemA->kind == PROBLEM_FAT_MISMATCH && problemA->entry != problemB->entry) return problemA->entry - problemB->entry;
+	if (problemA->cluster != problemB->cluster) return problemA->cluster - problemB->cluster;
+	return problemA->entry - problemB->entry;
+}
+
+// Gathers every worker's problems in report order, joining the pieces that were split by the cluster ranges:
+// one FAT mismatch per copy and one run per stretch of lost clusters. Returns the number of problems.
+int merge_problems(check_state *state, problem **merged) {
+	int total = 0;
+	int i;
+	for (i = 0; i < state->num_workers; i ++) {
+		total += state->worker_problems[i].num_problems;
+	}
+
+	*merged = malloc((total + 1) * sizeof(problem));
+	int num_merged = 0;
+	for (i = 0; i < state->num_workers; i ++) {
+		int j;
+		for (j = 0; j < state->worker_problems[i].num_problems; j ++) {
+			(*merged)[num_merged ++] = state->worker_problems[i].problems[j];
+		}
+	}
+	qsort(*merged, num_merged, sizeof(problem), compare_problems);
+
+	int kept = 0;
+	for (i = 0; i < num_merged; i ++) {
+		problem *current = &(*merged)[i];
+		problem *last = kept > 0 ? &(*merged)[kept - 1] : NULL;
+
+		if (last != NULL && current->kind == PROBLEM_FAT_MISMATCH && last->kind == PROBLEM_FAT_MISMATCH && current->entry == last->entry) {
+			last->actual += current->actual;
+		} else if (last != NULL && current->kind == PROBLEM_LOST_CLUSTERS && last->kind == PROBLEM_LOST_CLUSTERS && last->cluster + last->actual == current->cluster) {
+			last->actual += current->actual;
+		} else {
+			(*merged)[kept ++] = *current;
+		}
+	}
+
+	return kept;
+}
+
+void print_problem(check_state *state, problem *found) {
+	char path[WALK_PATH_MAX];
+	if (found->entry >= 0 && found->kind != PROBLEM_FAT_MISMATCH) {
+		get_walk_path(state->mmap, state->entries, found->entry, path);
+	}
+
+	switch (found->kind) {
+		case PROBLEM_FAT_MISMATCH:
+			printf("FAT copy %d differs from FAT copy 1 in %d entr%s, starting at cluster %d\n", found->entry + 1, found->actual, found->actual == 1 ? "y" : "ies", found->cluster);
+			break;
+		case PROBLEM_BAD_CHAIN:
+			if (found->cluster < 2 || found->cluster >= state->geometry.total_clusters + 2) {
+				printf("%s: chain points outside the data area at cluster %d\n", path, found->cluster);
+			} else if (found->expected == 0xFF7) {
+				printf("%s: chain runs into bad cluster %d\n", path, found->cluster);
+			} else {
+				printf("%s: chain runs into free cluster %d\n", path, found->cluster);
+			}
+			break;
+		case PROBLEM_CROSS_LINK:
+			printf("%s: cross-linked at cluster %d\n", path, found->cluster);
+			break;
+		case PROBLEM_SIZE_MISMATCH:
+			printf("%s: size needs %d clusters but the chain has %d\n", path, found->expected, found->actual);
+			break;
+		case PROBLEM_LOST_CLUSTERS:
+			if (found->actual == 1) {
+				printf("Lost cluster %d\n", found->cluster);
+			} else {
+				printf("Lost clusters %d-%d\n", found->cluster, found->cluster + found->actual - 1);
+			}
+			break;
+	}
+}
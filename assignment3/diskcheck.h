@@ -0,0 +1,54 @@
+#ifndef DISKCHECK_H_INCLUDED
+#define DISKCHECK_H_INCLUDED
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "disk_layout.h"
+#include "fat_table.h"
+#include "dir_walk.h"
+#include "batch.h"
+
+// Kinds of problem, in the order they are reported
+#define PROBLEM_FAT_MISMATCH 0
+#define PROBLEM_BAD_CHAIN 1
+#define PROBLEM_CROSS_LINK 2
+#define PROBLEM_SIZE_MISMATCH 3
+#define PROBLEM_LOST_CLUSTERS 4
+
+typedef struct {
+	int kind;
+	int cluster;
+	int entry;
+	int expected;
+	int actual;
+} problem;
+
+typedef struct {
+	problem *problems;
+	int num_problems;
+	int capacity;
+} problem_list;
+
+typedef struct {
+	char *mmap;
+	disk_geometry geometry;
+	fat_table *table;
+	uint16_t **fat_copies;
+	walk_entry *entries;
+	int num_entries;
+	atomic_uint_least64_t *claimed;
+	atomic_uint_least64_t *cross_linked;
+	int num_workers;
+	problem_list *worker_problems;
+} check_state;
+
+void run_in_parallel(check_state *state, int total, void (*work)(check_state *state, int worker, int start, int end));
+void compare_fat_copies(check_state *state, int worker, int start, int end);
+void check_chains(check_state *state, int worker, int start, int end);
+void check_lost_clusters(check_state *state, int worker, int start, int end);
+void name_cross_links(check_state *state);
+void add_problem(problem_list *list, int kind, int cluster, int entry, int expected, int actual);
+int merge_problems(check_state *state, problem **merged);
+void print_problem(check_state *state, problem *found);
+
+#endif
@@ -0,0 +1,274 @@
+// Rewrites a file system image so every file and directory sits in one contiguous run of clusters, packed
+// toward the start of the data area.
+// Invoked as follows: ./diskdefrag disk.IMA
+//
+// The whole move is planned before anything is touched: the tree is walked, every chain followed, and each
+// cluster given its new home in walk order, stepping around bad clusters. The new data area is then put
+// together in memory with one copy per run of clusters that stays contiguous across the move, the directory
+// entries (including the . and .. links inside each directory) are pointed at the new chains, and the FAT is
+// rebuilt from the plan. Everything goes back through the block cache in one commit, and only clusters whose
+// contents actually changed are written.
+//
+// The moves overwrite clusters the old FAT still points at, so an interrupted defrag can't be rolled back the
+// way a put can. Keep a copy of anything that matters. An image with broken or cross-linked chains is left
+// alone; run diskcheck on it first. So is one with directories nested too deep to walk, since the clusters
+// under them would be taken for free space and handed to other files.
+//
+// Lost clusters, allocated in the FAT but not part of any chain, are freed by the rebuild. How many were freed
+// is printed once the image has been written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h> // memcpy, memcmp
+#include <errno.h>
+#include "diskdefrag.h"
+
+int main(int argc, char *argv[])
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: diskdefrag <file system image>\n");
+		return -1;
+	}
+
+	block_cache *cache = open_block_cache(argv[1], 0);
+	if (cache == NULL) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "%s: Not a FAT12 image\n", argv[1]);
+		} else {
+			perror("Error opening file system image");
+		}
+		exit(EXIT_FAILURE);
+	}
+
+	defrag_plan plan;
+	plan.mmap = cache->mmap;
+	get_disk_geometry(plan.mmap, &plan.geometry);
+	plan.table = load_fat_table(plan.mmap);
+	int num_skipped;
+	plan.num_entries = walk_directories(plan.mmap, plan.table, 1, &plan.entries, &num_skipped);
+
+	if (num_skipped > 0) {
+		print_skipped_directories(stderr, plan.mmap, plan.entries, plan.num_entries, num_skipped, argv[1]);
+		printf("The directory tree could not be walked completely, so the image was left alone\n");
+		return 1;
+	}
+
+	if (plan_defrag(&plan) < 0) {
+		printf("The image has broken or cross-linked cluster chains; run diskcheck first\n");
+		return 1;
+	}
+
+	char *data_area = build_data_area(&plan);
+	update_entries(&plan, cache, data_area);
+
+	// Only write back the clusters that ended up with different contents
+	int bytes_per_cluster = plan.geometry.bytes_per_cluster;
+	int cluster;
+	for (cluster = 2; cluster < plan.end_cluster; cluster ++) {
+		char *destination = plan.mmap + get_cluster_offset(&plan.geometry, cluster);
+		char *source = data_area + ((long) (cluster - 2) * bytes_per_cluster);
+		if (memcmp(destination, source, bytes_per_cluster) != 0) {
+			memcpy(destination, source, bytes_per_cluster);
+			mark_dirty(cache, get_cluster_offset(&plan.geometry, cluster), bytes_per_cluster);
+		}
+	}
+
+	rebuild_fat(&plan);
+	mark_dirty(cache, (long) plan.geometry.first_fat_sector * plan.geometry.bytes_per_sector, (long) plan.geometry.total_fats * plan.geometry.sectors_per_fat * plan.geometry.bytes_per_sector);
+
+	if (commit_block_cache(cache) < 0) {
+		perror("Error writing file system image");
+		exit(EXIT_FAILURE);
+	}
+
+	if (plan.lost_clusters > 0) {
+		printf("Freed %d lost cluster%s (allocated in the FAT but not part of any file or directory)\n",
+			plan.lost_clusters, plan.lost_clusters == 1 ? "" : "s");
+	}
+
+	free(data_area);
+	free(plan.plans);
+	free(plan.old_clusters);
+	free(plan.new_cluster);
+	free(plan.entries);
+	free_fat_table(plan.table);
+	close_block_cache(cache);
+	return 0;
+}
+
+// Bad clusters (0xFF7) and the reserved values below them stay where they are
+int is_reserved_cluster(int value) {
+	return value >= 0xFF0 && value <= 0xFF7;
+}
+
+// Follows every chain in walk order and gives each of its clusters the next good cluster from the start of the
+// data area, then counts the lost clusters. Returns 0, or -1 if a chain leaves the data area, runs into a free
+// or bad cluster, or shares a cluster with another chain (or itself).
+int plan_defrag(defrag_plan *plan) {
+	int total_clusters = plan->geometry.total_clusters;
+	char *claimed = calloc(total_clusters + 2, 1);
+	int used = 0;
+	int next = 2;
+	int i;
+
+	plan->plans = malloc((plan->num_entries + 1) * sizeof(chain_plan));
+	plan->num_plans = 0;
+	plan->old_clusters = malloc((total_clusters + 1) * sizeof(int));
+	plan->new_cluster = calloc(total_clusters + 2, sizeof(int));
+
+	for (i = 0; i < plan->num_entries; i ++) {
+		int cluster = read_le16(&DIRECTORY_ENTRY(plan->mmap, plan->entries[i].entry_offset)->first_cluster);
+		if (cluster == 0) {
+			continue;
+		}
+
+		chain_plan *chain = &plan->plans[plan->num_plans ++];
+		chain->entry = i;
+		chain->first = used;
+		chain->length = 0;
+
+		while (1) {
+			if (cluster < 2 || cluster >= total_clusters + 2 || claimed[cluster]) {
+				free(claimed);
+				return -1;
+			}
+			int value = plan->table->entries[cluster];
+			if (value == 0x00 || is_reserved_cluster(value)) {
+				free(claimed);
+				return -1;
+			}
+
+			while (is_reserved_cluster(plan->table->entries[next])) {
+				next ++;
+			}
+			claimed[cluster] = 1;
+			plan->old_clusters[used ++] = cluster;
+			plan->new_cluster[cluster] = next ++;
+			chain->length ++;
+
+			if (value >= 0xFF8) {
+				break;
+			}
+			cluster = value;
+		}
+	}
+
+	plan->end_cluster = next;
+
+	// Whatever is still allocated but unclaimed is lost and won't survive the rebuild
+	plan->lost_clusters = 0;
+	for (i = 2; i < total_clusters + 2; i ++) {
+		int value = plan->table->entries[i];
+		if (value != 0x00 && !is_reserved_cluster(value) && !claimed[i]) {
+			plan->lost_clusters ++;
+		}
+	}
+	free(claimed);
+	return 0;
+}
+
+// Puts the new contents of clusters 2 to end_cluster - 1 together in a malloc'd buffer.
+char *build_data_area(defrag_plan *plan) {
+	int bytes_per_cluster = plan->geometry.bytes_per_cluster;
+	char *data_area = malloc((long) (plan->end_cluster - 2) * bytes_per_cluster + 1);
+	int cluster;
+	int i;
+
+	// Bad clusters inside the packed range keep whatever is in them
+	for (cluster = 2; cluster < plan->end_cluster; cluster ++) {
+		if (is_reserved_cluster(plan->table->entries[cluster])) {
+			memcpy(data_area + ((long) (cluster - 2) * bytes_per_cluster), plan->mmap + get_cluster_offset(&plan->geometry, cluster), bytes_per_cluster);
+		}
+	}
+
+	for (i = 0; i < plan->num_plans; i ++) {
+		int *old_clusters = plan->old_clusters + plan->plans[i].first;
+		int length = plan->plans[i].length;
+		int j = 0;
+
+		// One copy per stretch that is contiguous both before and after the move
+		while (j < length) {
+			int run_length = 1;
+			while (j + run_length < length && old_clusters[j + run_length] == old_clusters[j] + run_length
+				&& plan->new_cluster[old_clusters[j + run_length]] == plan->new_cluster[old_clusters[j]] + run_length) {
+				run_length ++;
+			}
+
+			memcpy(data_area + ((long) (plan->new_cluster[old_clusters[j]] - 2) * bytes_per_cluster),
+				plan->mmap + get_cluster_offset(&plan->geometry, old_clusters[j]), (long) run_length * bytes_per_cluster);
+			j += run_length;
+		}
+	}
+
+	return data_area;
+}
+
+// Points every directory entry at its chain's new first cluster. Entries in the root directory are changed in
+// the cache; entries inside subdirectories are changed where their cluster now lives in data_area, along with
+// each directory's . and .. links.
+void update_entries(defrag_plan *plan, block_cache *cache, char *data_area) {
+	disk_geometry *geometry = &plan->geometry;
+	long data_start = (long) geometry->first_data_sector * geometry->bytes_per_sector;
+	int *new_first = calloc(plan->num_entries + 1, sizeof(int));
+	int i;
+
+	// Work out every new first cluster before any entry is changed, since a directory's .. needs its parent's
+	for (i = 0; i < plan->num_plans; i ++) {
+		new_first[plan->plans[i].entry] = plan->new_cluster[plan->old_clusters[plan->plans[i].first]];
+	}
+
+	for (i = 0; i < plan->num_plans; i ++) {
+		int index = plan->plans[i].entry;
+		long offset = plan->entries[index].entry_offset;
+		directory_entry *entry;
+
+		if (offset < data_start) {
+			entry = DIRECTORY_ENTRY(plan->mmap, offset);
+			mark_dirty(cache, offset, sizeof(directory_entry));
+		} else {
+			int old_cluster = (offset - data_start) / geometry->bytes_per_cluster + 2;
+			entry = (directory_entry *) (data_area + ((long) (plan->new_cluster[old_cluster] - 2) * geometry->bytes_per_cluster)
+				+ ((offset - data_start) % geometry->bytes_per_cluster));
+		}
+		write_le16(&entry->first_cluster, new_first[index]);
+
+		if ((entry->attributes & 0x10) == 0x10) {
+			directory_entry *dot = (directory_entry *) (data_area + ((long) (new_first[index] - 2) * geometry->bytes_per_cluster));
+			int parent = plan->entries[index].parent;
+			if (memcmp(dot[0].name, ".          ", 11) == 0) {
+				write_le16(&dot[0].first_cluster, new_first[index]);
+			}
+			// A .. that leads to the root directory holds 0
+			if (memcmp(dot[1].name, "..         ", 11) == 0) {
+				write_le16(&dot[1].first_cluster, parent < 0 ? 0 : new_first[parent]);
+			}
+		}
+	}
+
+	free(new_first);
+}
+
+// Frees every cluster that isn't bad, then links each chain through its new clusters and packs the FAT.
+void rebuild_fat(defrag_plan *plan) {
+	int cluster;
+	int i;
+
+	for (cluster = 2; cluster < plan->geometry.total_clusters + 2; cluster ++) {
+		if (!is_reserved_cluster(plan->table->entries[cluster])) {
+			set_fat_entry(plan->table, cluster, 0x00);
+		}
+	}
+
+	for (i = 0; i < plan->num_plans; i ++) {
+		int *old_clusters = plan->old_clusters + plan->plans[i].first;
+		int length = plan->plans[i].length;
+		int j;
+		for (j = 0; j < length; j ++) {
+			set_fat_entry(plan->table, plan->new_cluster[old_clusters[j]], j + 1 < length ? plan->new_cluster[old_clusters[j + 1]] : 0xFFF);
+		}
+	}
+
+	store_fat_table(plan->table, plan->mmap);
+}
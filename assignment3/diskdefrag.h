@@ -0,0 +1,40 @@
+#ifndef DISKDEFRAG_H_INCLUDED
+#define DISKDEFRAG_H_INCLUDED
+
+#include "disk_layout.h"
+#include "fat_table.h"
+#include "dir_walk.h"
+#include "block_cache.h"
+
+// Where one file or directory's chain goes. Its old clusters are old_clusters[first] to old_clusters[first + length - 1].
+typedef struct {
+	int entry;
+	int first;
+	int length;
+} chain_plan;
+
+typedef struct {
+	char *mmap;
+	disk_geometry geometry;
+	fat_table *table;
+	walk_entry *entries;
+	int num_entries;
+
+	// Every chain in walk order, then each old cluster's new home (0 if it is not in any chain)
+	chain_plan *plans;
+	int num_plans;
+	int *old_clusters;
+	int *new_cluster;
+	int end_cluster;
+
+	// Clusters the FAT has allocated that no chain reaches; rebuild_fat frees them
+	int lost_clusters;
+} defrag_plan;
+
+int is_reserved_cluster(int value);
+int plan_defrag(defrag_plan *plan);
+char *build_data_area(defrag_plan *plan);
+void update_entries(defrag_plan *plan, block_cache *cache, char *data_area);
+void rebuild_fat(defrag_plan *plan);
+
+#endif
@@ -3,16 +3,105 @@
 //
 // Your program for part III will be invoked as follows: ./diskget disk.IMA ANS1.PDF
 // ANS1.PDF should be copied to your current Linux directory, and you should be able to read the content of ANS1.PDF.
+// Several files can be copied with one invocation: ./diskget [-j workers] disk.IMA ANS1.PDF NOTES.TXT ...
+//
+// The file is streamed straight out of the mmap of the image: libfat12 lays the cluster chain out with
+// fat12_open_entry, runs of contiguous clusters are merged into a single iovec, and the iovecs are handed to writev in batches. No file
+// data is ever copied into an intermediate buffer. The name is looked up in the root directory index. When
+// several files are asked for, they are all looked up first and then streamed out on a pool of threads. A file
+// that can't be copied out in full is removed rather than left truncated.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>  // open
+#include <errno.h>
+#include "get_files.h"
 
 int main(int argc, char *argv[])
 {
-	if(argc != 2)
+	int num_workers = get_default_workers();
+	int option;
+
+	while ((option = getopt(argc, argv, "j:")) != -1) {
+		if (option == 'j') {
+			num_workers = atoi(optarg);
+		} else {
+			num_workers = 0;
+		}
+	}
+
+	if(argc - optind < 2 || num_workers < 1)
 	{
-		fprintf(stderr, "Usage: diskget <file system image> <file name>\n");
+		fprintf(stderr, "Usage: diskget [-j workers] <file system image> <file name>...\n");
 		return -1;
 	}
-	
-	return 0;
-}
\ No newline at end of file
+
+	char *file_system_image = argv[optind];
+	char **file_names = argv + optind + 1;
+	int num_files = argc - optind - 1;
+
+	fat12_image *image = fat12_open(file_system_image);
+	if (image == NULL) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "%s: Not a FAT12 image\n", file_system_image);
+		} else {
+			perror("Error opening file for reading");
+		}
+		exit(EXIT_FAILURE);
+	}
+
+	// Look every name up and open every output first, then stream the files out concurrently
+	dir_index *index = build_root_index(image->mmap);
+	get_plan *plans = malloc(num_files * sizeof(get_plan));
+	int num_plans = 0;
+	int failed = 0;
+	int i;
+	for (i = 0; i < num_files; i ++) {
+		char short_name[11];
+		if (make_short_name(short_name, file_names[i]) < 0) {
+			if (num_files > 1) {
+				printf("%s: ", file_names[i]);
+			}
+			printf("Not a valid 8.3 file name\n");
+			failed = 1;
+			continue;
+		}
+		dir_index_slot *slot = find_in_index(index, short_name);
+		if (slot == NULL || (slot->attributes & 0x10) == 0x10) {
+			if (num_files > 1) {
+				printf("%s: ", file_names[i]);
+			}
+			printf("File not found\n");
+			failed = 1;
+			continue;
+		}
+
+		get_plan *plan = &plans[num_plans];
+		plan->file_name = file_names[i];
+		plan->entry_offset = slot->entry_offset;
+		plan->failed = 0;
+		if ((plan->out_fd = open(file_names[i], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			perror(file_names[i]);
+			failed = 1;
+			continue;
+		}
+		num_plans ++;
+	}
+	free_dir_index(index);
+
+	copy_files_out(image, plans, num_plans, num_workers);
+
+	for (i = 0; i < num_plans; i ++) {
+		close(plans[i].out_fd);
+		if (plans[i].failed) {
+			// Don't leave a truncated copy behind
+			unlink(plans[i].file_name);
+			failed = 1;
+		}
+	}
+	free(plans);
+
+	fat12_close(image);
+	return failed ? EXIT_FAILURE : 0;
+}
@@ -9,206 +9,120 @@
 // =============
 // Number of FAT copies:
 // Sectors per FAT:
+//
+// Batch mode reports on many images at once, one CSV row or JSON object per image, in input order:
+// ./diskinfo -b <list file or directory of images> [-j workers] [-f csv|jsonl]
+// An image that can't be read gets a row with only its name and an error, and diskinfo then exits with 1.
+//
+// Everything reported comes from fat12_statfs in libfat12.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>  // mmap
-#include <fcntl.h>  // open
-#include <sys/stat.h> // fstat
+#include <errno.h>
 #include "diskinfo.h"
+#include "batch.h"
 
 int main(int argc, char *argv[]) {
-	if(argc != 2)
+	char *batch_source = NULL;
+	int num_workers = get_default_workers();
+	int format = BATCH_CSV;
+	int option;
+	
+	while ((option = getopt(argc, argv, "b:j:f:")) != -1) {
+		switch (option) {
+			case 'b':
+				batch_source = optarg;
+				break;
+			case 'j':
+				num_workers = atoi(optarg);
+				break;
+			case 'f':
+				format = get_batch_format(optarg);
+				break;
+			default:
+				format = -1;
+		}
+	}
+	
+	if ((batch_source == NULL && argc - optind != 1) || (batch_source != NULL && argc != optind) || num_workers < 1 || format < 0)
 	{
 		fprintf(stderr, "Usage: diskinfo <file system image>\n");
+		fprintf(stderr, "       diskinfo -b <image list or directory> [-j workers] [-f csv|jsonl]\n");
 		return -1;
 	}
 	
-	char *file_system_image = argv[1];
-	char *os_name = malloc(sizeof(char) * 8);
-	char *disk_label = malloc(sizeof(char) * 11);
-	int disk_size_total = 0;
-	int disk_size_free = 0;
-	int num_files_in_root = 0;
-	int num_fat_copies = 0;
-	int sectors_per_fat = 0;
-	
-	int fd;
-	struct stat file_stats;
-	char *map;
-	
-	if ((fd = open(file_system_image, O_RDONLY))) {
-		// Return information about the file and store it in file_stats
-		fstat(fd, &file_stats);
-
-		// void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
-		map = mmap(NULL, file_stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (batch_source != NULL) {
+		char **images;
+		int num_images = get_batch_images(batch_source, &images);
+		if (num_images < 0) {
+			perror("Error reading image list");
+			exit(EXIT_FAILURE);
+		}
 		
-		get_os_name(os_name, map);
-		get_disk_label(disk_label, map);
-		disk_size_total = get_total_size(map);
-		num_fat_copies = get_total_fats(map);
-		sectors_per_fat = get_sectors_per_fat(map);
-		disk_size_free = get_free_size(map);
-		num_files_in_root = get_total_files_in_root(map);
-	} else {
-		perror("Error opening file for reading");
+		int failures = run_batch(images, num_images, num_workers, format,
+			"image,os_name,label,total_size,free_size,files_in_root,fat_copies,sectors_per_fat,error", report_disk_info);
+		free_batch_images(images, num_images);
+		return failures > 0 ? EXIT_FAILURE : 0;
+	}
+	
+	char *file_system_image = argv[optind];
+	fat12_image *image = fat12_open(file_system_image);
+	if (image == NULL) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "%s: Not a FAT12 image\n", file_system_image);
+		} else {
+			perror("Error opening file for reading");
+		}
 		exit(EXIT_FAILURE);
 	}
 	
-	printf("OS Name: %s\n", os_name);
-	printf("Label of the disk: %s\n", disk_label);
-	printf("Total size of the disk: %d\n", disk_size_total);
-	printf("Free size on the disk: %d\n", disk_size_free);
+	fat12_info info;
+	fat12_statfs(image, &info);
+	
+	printf("OS Name: %s\n", info.os_name);
+	printf("Label of the disk: %s\n", info.disk_label);
+	printf("Total size of the disk: %ld\n", info.total_size);
+	printf("Free size on the disk: %ld\n", info.free_size);
 	printf("==========================================\n");
-	printf("Number of files in the root directory: %d\n", num_files_in_root);
+	printf("Number of files in the root directory: %d\n", info.num_files_in_root);
 	printf("==========================================\n");
-	printf("Number of FAT copies: %d\n", num_fat_copies);
-	printf("Sectors per FAT: %d\n", sectors_per_fat);
+	printf("Number of FAT copies: %d\n", info.num_fat_copies);
+	printf("Sectors per FAT: %d\n", info.sectors_per_fat);
 	
-	free(os_name);
-	close(fd);
+	fat12_close(image);
 	return 0;
 }
 
-void get_os_name(char *os_name, char *mmap) {	
-	int i;
-	for(i = 0; i < 8; i++) {
-		os_name[i] = mmap[3+i];
-	}
+// Fills info in for an image that is already mapped.
+void get_disk_info(char *mmap, fat12_info *info) {
+	fat12_image image;
+	fat12_attach(&image, mmap);
+	fat12_statfs(&image, info);
+	fat12_detach(&image);
 }
 
-void get_disk_label(char *disk_label, char *mmap) {
-	int bytes_per_sector = get_bytes_per_sector(mmap);
-	int i;
-	// Directory entries are 32 bytes long
-	for (i = 19; i <= 32; i ++) {
-		int j = 0;
-		for (j = 0; j < 16; j++) {
-			int attributeValue = mmap[(i * bytes_per_sector) + (j * 32) + 11];
-			if ((attributeValue & 0x08) == 0x08 && (attributeValue & 0x0F) != 0x0F) {
-				int k;
-				for(k = 0; k < 11; k++) {
-					disk_label[k] = mmap[(i * bytes_per_sector) + (j * 32) + k];
-				}
-				
-				return;
-			}
-		}
-	}
+// Batch mode callback: one CSV row or JSON object for the image.
+const char *report_disk_info(char *image_name, char *mmap, FILE *out, int format) {
+	fat12_info info;
+	get_disk_info(mmap, &info);
 	
-}
-
-int get_total_sectors(char *mmap) {
-	return get_two_byte_value(mmap, 19);
-}
-
-int get_bytes_per_sector(char *mmap) {
-	return get_two_byte_value(mmap, 11);
-}
-
-int get_sectors_per_cluster(char *mmap) {
-	return mmap[13];
-}
-
-int get_total_fats(char *mmap) {
-	// Number of FATs starts at byte 16 of the boot sector and is 1 byte in length
-	return mmap[16];
-}
-
-int get_sectors_per_fat(char *mmap) {
-	return get_two_byte_value(mmap, 22);
-}
-
-int get_total_size(char *mmap) {
-	return get_total_sectors(mmap) * get_bytes_per_sector(mmap);
-}
-
-int get_free_size(char *mmap) {
-	// Logical index of data area is 2-2848
-	// Physical index of data area is 33-2879
-	// Count the number of sectors in use and subtract that amount from the total sectors to get free space
-	int bytes_per_sector = get_bytes_per_sector(mmap);
-	int free_sectors = 0;
-	int i;
-	for (i = 2; i <= 2848; i ++) {
-		// Directory entries are 32 bytes long
-		int *tmp1 = malloc(sizeof(int));
-		int *tmp2 = malloc(sizeof(int));
-		int result = 0;
-		
-		// If the logical number is even a + b << 8
-		if (i % 2 == 0) {
-			*tmp1 = (unsigned char) mmap[512 + (3*i)/2];
-			*tmp2 = (unsigned char) mmap[513 + (3*i)/2];
-			*tmp2 = *tmp2 & 0x0F; // get the low 4 bits
-			
-			result = *tmp1 + (*tmp2 << 8);
-			
-		
-		// If the logical number is odd a >> 4 + b << 4
-		} else {
-			*tmp1 = (unsigned char) mmap[512 + (3*i)/2];
-			*tmp1 = *tmp1 & 0xF0; // get the high 4 bits
-			*tmp2 = (unsigned char) mmap[513 + (3*i)/2];
-			
-			result = (*tmp1 >> 4) + (*tmp2 << 4);
-		}
-		
-		// If the value is 0x00, that sector is free
-		if (result == 0x00) {
-			free_sectors ++;
-		}
-	}
-
-	printf("Free sectors: %d\n", free_sectors);
-	return free_sectors * bytes_per_sector;
-}
-
-int get_total_files_in_root(char *mmap) {
-	int bytes_per_sector = get_bytes_per_sector(mmap);
-	int files = 0;
-	int i;
-	for (i = 19; i <= 32; i ++) {
-		// Directory entries are 32 bytes long
-		int j = 0;
-		for (j = 0; j < 16; j++) {
-			int attributeValue = mmap[(i * bytes_per_sector) + (j * 32) + 11];
-			
-			// If the first byte of the Filename field is 0x00, then this directory entry is free and all the
-			// remaining directory entries in this directory are also free.
-			if (mmap[(i * bytes_per_sector) + (j * 32)] == 0x00) {
-				return files;
-			}
-			
-			if ((attributeValue & 0x0F) != 0x0F && (attributeValue & 0x08) != 0x08 && (attributeValue & 0x10) != 0x10) {
-				files ++;
-			}
-		}
+	if (format == BATCH_CSV) {
+		print_csv_string(out, image_name);
+		fputc(',', out);
+		print_csv_string(out, info.os_name);
+		fputc(',', out);
+		print_csv_string(out, info.disk_label);
+		fprintf(out, ",%ld,%ld,%d,%d,%d,\n", info.total_size, info.free_size, info.num_files_in_root, info.num_fat_copies, info.sectors_per_fat);
+	} else {
+		fprintf(out, "{\"image\":");
+		print_json_string(out, image_name);
+		fprintf(out, ",\"os_name\":");
+		print_json_string(out, info.os_name);
+		fprintf(out, ",\"label\":");
+		print_json_string(out, info.disk_label);
+		fprintf(out, ",\"total_size\":%ld,\"free_size\":%ld,\"files_in_root\":%d,\"fat_copies\":%d,\"sectors_per_fat\":%d}\n",
+			info.total_size, info.free_size, info.num_files_in_root, info.num_fat_copies, info.sectors_per_fat);
 	}
-	
-	return files;
-}
-
-int get_max_root_directory_entries(char *mmap) {
-	return get_two_byte_value(mmap, 17);
+	return NULL;
 }
-
-int get_two_byte_value(char *mmap, int offset) {
-	int *tmp1 = malloc(sizeof(int));
-	int *tmp2 = malloc(sizeof(int));
-	int retVal;
-	
-	// Beginning of data area starts at byte 33 of the boot sector and is 2 bytes in length
-	* tmp1 = (unsigned char) mmap[offset];
-	* tmp2 = (unsigned char) mmap[offset + 1];
-	
-	// Switch to Big Endian format
-	retVal = *tmp1 + ((*tmp2) << 8);
-	
-	free(tmp1);
-	free(tmp2);
-	
-	return retVal;
-}
\ No newline at end of file
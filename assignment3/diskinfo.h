@@ -1,17 +1,10 @@
 #ifndef DISKINFO_H_INCLUDED
 #define DISKINFO_H_INCLUDED
 
-void get_os_name(char *os_name, char *mmap);
-void get_disk_label(char *disk_label, char *mmap);
-int get_total_sectors(char *mmap);
-int get_bytes_per_sector(char *mmap);
-int get_sectors_per_cluster(char *mmap);
-int get_total_fats(char *mmap);
-int get_sectors_per_fat(char *mmap);
-int get_total_size(char *mmap);
-int get_free_size(char *mmap);
-int get_total_files_in_root(char *mmap);
-int get_max_root_directory_entries(char *mmap);
-int get_two_byte_value(char *mmap, int offset);
+#include <stdio.h>
+#include "fat12.h"
+
+void get_disk_info(char *mmap, fat12_info *info);
+const char *report_disk_info(char *image_name, char *mmap, FILE *out, int format);
 
 #endif
\ No newline at end of file
@@ -1,20 +1,74 @@
 // Copies a file from the current Linux directory into the root directory of the file system.
 // If the specified file is not found, output the message "File not found" on a single line and exit. If the
 // file system does not have enough free space to store the file, output "Not enough free space in the disk image" and exit.
+// A name that isn't a valid 8.3 name is reported rather than shortened, and a file bigger than the whole data
+// area is turned away before any clusters are looked for.
 //
-// Your program will be invoked as follows: ./diskput disk.IMA foo.txt
+// Your program will be invoked as follows: ./diskput [-l] [-j workers] disk.IMA foo.txt [bar.txt ...]
+// or with the files to put listed one per line in a manifest: ./diskput -m manifest disk.IMA
 // Note that a correct execution should update FAT and related allocation information in disk.IMA accordingly.
 // To validate, you can use diskget implemented in Part III to check if you can correctly read foo.txt from the file system.
+//
+// Free clusters are handed out as contiguous extents: the first free run that can hold the whole file wins, and
+// only if there is none is the file spread over the largest runs available. Both the space check and the first
+// fit search work on the table's free cluster bitmap rather than the entries. The new chain is built in the decoded
+// FAT table which is then packed over every FAT copy in a single pass. Name checks and the choice of directory
+// entry go through the root directory index.
+//
+// Several files can be put with the image opened once. The whole batch is planned first, serially: names,
+// directory entries and extents for every file. The payloads are then copied concurrently, since no two files
+// share a cluster. Every change is made in a block cache over the image and written back in one ordered commit: the data
+// clusters, then the FATs and root directory together. With -l the old metadata is journaled first, so a put
+// that is interrupted part way is rolled back the next time the image is opened. The exit status is non-zero if
+// any file in the batch could not be put.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "put_files.h"
 
 int main(int argc, char *argv[])
 {
-	if(argc != 2)
+	int journaled = 0;
+	int num_workers = get_default_workers();
+	char *manifest = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "lj:m:")) != -1) {
+		if (option == 'l') {
+			journaled = 1;
+		} else if (option == 'j') {
+			num_workers = atoi(optarg);
+		} else if (option == 'm') {
+			manifest = optarg;
+		} else {
+			num_workers = 0;
+		}
+	}
+
+	char **file_names = argv + optind + 1;
+	int num_files = argc - optind - 1;
+	if (manifest != NULL && num_files > 0) {
+		fprintf(stderr, "A manifest can't be combined with file names\n");
+		return -1;
+	}
+	int from_manifest = manifest != NULL && num_files == 0;
+	if (from_manifest && (num_files = get_batch_images(manifest, &file_names)) < 0) {
+		perror("Error reading manifest");
+		exit(EXIT_FAILURE);
+	}
+
+	if(argc - optind < 1 || num_files < 1 || num_workers < 1)
 	{
-		fprintf(stderr, "Usage: diskput <file system image> <file name>\n");
+		fprintf(stderr, "Usage: diskput [-l] [-j workers] <file system image> <file name>...\n");
+		fprintf(stderr, "       diskput [-l] [-j workers] -m <manifest> <file system image>\n");
 		return -1;
 	}
-	
-	return 0;
-}
\ No newline at end of file
+
+	int failures = put_files(argv[optind], file_names, num_files, journaled, num_workers);
+
+	if (from_manifest) {
+		free_batch_images(file_names, num_files);
+	}
+	return failures != 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,385 @@
+// libfat12: read-only image access behind a handle, for programs that want the files without running a tool.
+//
+// diskinfo takes its numbers from fat12_statfs, disklist reads the root directory with fat12_readdir and diskget
+// streams files from the chains fat12_open_entry lays out. In batch mode they already hold a mapping, and wrap it
+// with fat12_attach instead of opening the image again. fat12_open maps the image read-only and decodes the FAT
+// once; after that every call only reads the mapping and the decoded table, so the handle needs no locking. Paths
+// are looked up one component at a time, each name put in its 8.3 form by make_short_name. An open file keeps its
+// whole chain as an array, which lets fat12_pread go straight to the cluster for any offset.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>  // mmap
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include <string.h> // memcpy, memcmp
+#include <errno.h>
+#include "fat12.h"
+#include "dir_index.h"
+
+// Opens the image at path. Returns NULL on an error (errno is set, EINVAL if it isn't a FAT12 image).
+fat12_image *fat12_open(const char *path) {
+	fat12_image *image = malloc(sizeof(fat12_image));
+	struct stat file_stats;
+
+	if ((image->fd = open(path, O_RDONLY)) < 0) {
+		free(image);
+		return NULL;
+	}
+
+	// Return information about the file and store it in file_stats
+	fstat(image->fd, &file_stats);
+	image->size = file_stats.st_size;
+
+	image->mmap = mmap(NULL, image->size, PROT_READ, MAP_SHARED, image->fd, 0);
+	if (image->mmap == MAP_FAILED || !is_fat12_image(image->mmap, image->size)) {
+		int error = image->mmap == MAP_FAILED ? errno : EINVAL;
+		if (image->mmap != MAP_FAILED) {
+			munmap(image->mmap, image->size);
+		}
+		close(image->fd);
+		free(image);
+		errno = error;
+		return NULL;
+	}
+
+	get_disk_geometry(image->mmap, &image->geometry);
+	image->table = load_fat_table(image->mmap);
+	return image;
+}
+
+void fat12_close(fat12_image *image) {
+	fat12_detach(image);
+	munmap(image->mmap, image->size);
+	close(image->fd);
+	free(image);
+}
+
+// Sets image up over a FAT12 image the caller has already mapped and checked. The mapping stays the caller's;
+// fat12_detach only lets go of what was decoded from it.
+void fat12_attach(fat12_image *image, char *mmap) {
+	image->fd = -1;
+	image->mmap = mmap;
+	image->size = 0;
+	get_disk_geometry(mmap, &image->geometry);
+	image->table = load_fat_table(mmap);
+}
+
+void fat12_detach(fat12_image *image) {
+	free_fat_table(image->table);
+}
+
+// Seconds east of UTC of the local time zone at when.
+static long get_zone_offset(time_t when) {
+	struct tm local;
+	return localtime_r(&when, &local) != NULL ? local.tm_gmtoff : 0;
+}
+
+// Dates are day (5 bits), month (4 bits), years since 1980 (7 bits). Times are seconds / 2 (5 bits), minutes (6 bits), hours (5 bits).
+// Every entry of a listing goes through here twice, so this counts the days itself rather than calling mktime,
+// which checks the time zone file again on every call. Out of range months and days roll over as mktime's do.
+static time_t get_entry_time(int date, int time) {
+	if (date == 0) {
+		return 0;
+	}
+
+	int year = (date >> 9) + 1980;
+	int month = ((date >> 5) & 0x0F) - 1;
+	int day = date & 0x1F;
+	if (month < 0) {
+		month += 12;
+		year --;
+	} else if (month >= 12) {
+		month -= 12;
+		year ++;
+	}
+
+	// Days since 1970-01-01 in a calendar whose years start in March, so the leap day comes last
+	int march_year = month < 2 ? year - 1 : year;
+	int day_of_year = ((153 * (month < 2 ? month + 10 : month - 2)) + 2) / 5 + day - 1;
+	long days = (march_year * 365L) + (march_year / 4) - (march_year / 100) + (march_year / 400) + day_of_year - 719468;
+	time_t seconds = (days * 86400) + ((time >> 11) * 3600) + (((time >> 5) & 0x3F) * 60) + ((time & 0x1F) * 2);
+
+	// The fields are local time. Across a daylight saving change the offset from before it wins, which is what
+	// mktime does with a time that is skipped or repeated. The offsets either side of the last day looked up
+	// are kept per thread, since the entries of a directory tend to share a handful of dates.
+	static _Thread_local long cached_days = -1;
+	static _Thread_local long before;
+	static _Thread_local long after;
+	if (days != cached_days) {
+		before = get_zone_offset((days - 1) * 86400);
+		after = get_zone_offset((days + 2) * 86400);
+		cached_days = days;
+	}
+	if (before != after && get_zone_offset(seconds - before) != before && get_zone_offset(seconds - after) == after) {
+		return seconds - after;
+	}
+	return seconds - before;
+}
+
+static void fill_stat(fat12_image *image, long offset, fat12_stat *stat) {
+	directory_entry *entry = DIRECTORY_ENTRY(image->mmap, offset);
+	get_entry_name(image->mmap, stat->name, offset);
+	stat->is_directory = (entry->attributes & 0x10) == 0x10;
+	stat->size = stat->is_directory ? 0 : read_le32(&entry->file_size);
+	stat->first_cluster = read_le16(&entry->first_cluster);
+	stat->created = get_entry_time(read_le16(&entry->creation_date), read_le16(&entry->creation_time));
+	stat->modified = get_entry_time(read_le16(&entry->last_write_date), read_le16(&entry->last_write_time));
+	stat->entry_offset = offset;
+}
+
+// Steps dir on to its next raw directory entry. Returns 0 once the directory has no more entries.
+static int next_entry(fat12_dir *dir, long *offset) {
+	disk_geometry *geometry = &dir->image->geometry;
+
+	// The root directory has a fixed size and place; subdirectories are cluster chains
+	if (dir->cluster == 0) {
+		if (dir->index >= geometry->root_entries) {
+			return 0;
+		}
+		*offset = get_root_entry_offset(geometry, dir->index ++);
+	} else {
+		int entries_per_cluster = geometry->bytes_per_cluster / 32;
+		if (dir->index == entries_per_cluster) {
+			dir->cluster = dir->image->table->entries[dir->cluster];
+			dir->index = 0;
+
+			// A chain longer than the disk has clusters can only be a loop
+			if (++ dir->steps >= geometry->total_clusters) {
+				return 0;
+			}
+		}
+		if (dir->cluster < 2 || dir->cluster >= geometry->total_clusters + 2) {
+			return 0;
+		}
+		*offset = get_cluster_offset(geometry, dir->cluster) + (dir->index ++ * 32);
+	}
+
+	// If the first byte of the Filename field is 0x00, then this directory entry is free and all the
+	// remaining directory entries in this directory are also free.
+	return dir->image->mmap[*offset] != 0x00;
+}
+
+void fat12_statfs(fat12_image *image, fat12_info *info) {
+	disk_geometry *geometry = &image->geometry;
+
+	memset(info, 0, sizeof(fat12_info));
+	memcpy(info->os_name, BOOT_SECTOR(image->mmap)->os_name, 8);
+	trim_spaces(info->os_name);
+
+	long label_offset = get_volume_label_offset(image->mmap, geometry);
+	if (label_offset >= 0) {
+		memcpy(info->disk_label, image->mmap + label_offset, 11);
+		trim_spaces(info->disk_label);
+	}
+
+	// Files only, so the entries of subdirectories and the volume label are left out
+	fat12_dir root = { image, 0, 0, 0 };
+	long offset;
+	while (next_entry(&root, &offset)) {
+		if (is_named_entry(image->mmap, offset) && (DIRECTORY_ENTRY(image->mmap, offset)->attributes & 0x10) != 0x10) {
+			info->num_files_in_root ++;
+		}
+	}
+
+	info->total_size = (long) geometry->total_sectors * geometry->bytes_per_sector;
+	info->free_size = (long) count_free_clusters(image->table) * geometry->bytes_per_cluster;
+	info->num_fat_copies = geometry->total_fats;
+	info->sectors_per_fat = geometry->sectors_per_fat;
+}
+
+// Looks short_name up in the directory starting at cluster (0 for the root). Returns 0 or -1 if it isn't there.
+static int find_entry(fat12_image *image, int cluster, const char *short_name, fat12_stat *stat) {
+	fat12_dir dir = { image, cluster, 0, 0 };
+	long offset;
+
+	while (next_entry(&dir, &offset)) {
+		if (!is_named_entry(image->mmap, offset)) {
+			continue;
+		}
+		if (memcmp(image->mmap + offset, short_name, 11) == 0) {
+			fill_stat(image, offset, stat);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Looks up a path such as /DOCS/NOTES.TXT, in any case. Returns 0 or -1 (errno is ENOENT or ENOTDIR).
+int fat12_stat_path(fat12_image *image, const char *path, fat12_stat *stat) {
+	memset(stat, 0, sizeof(fat12_stat));
+	strcpy(stat->name, "/");
+	stat->is_directory = 1;
+
+	while (*path != '\0') {
+		const char *end = strchr(path, '/');
+		int length = end ? (int) (end - path) : (int) strlen(path);
+		char component[256];
+		char short_name[11];
+
+		if (length == 0) {
+			path ++;
+			continue;
+		}
+		if (!stat->is_directory) {
+			errno = ENOTDIR;
+			return -1;
+		}
+		if (length >= (int) sizeof(component)) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		memcpy(component, path, length);
+		component[length] = '\0';
+		if (make_short_name(short_name, component) < 0 || find_entry(image, stat->first_cluster, short_name, stat) < 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		path += length;
+	}
+
+	return 0;
+}
+
+// Opens the directory at path for fat12_readdir. Returns NULL on an error (errno is set).
+fat12_dir *fat12_opendir(fat12_image *image, const char *path) {
+	fat12_stat stat;
+	if (fat12_stat_path(image, path, &stat) < 0) {
+		return NULL;
+	}
+	if (!stat.is_directory) {
+		errno = ENOTDIR;
+		return NULL;
+	}
+
+	fat12_dir *dir = malloc(sizeof(fat12_dir));
+	dir->image = image;
+	dir->cluster = stat.first_cluster;
+	dir->index = 0;
+	dir->steps = 0;
+	return dir;
+}
+
+// Fills stat with the next file or directory. Returns 1, or 0 once the directory is done.
+int fat12_readdir(fat12_dir *dir, fat12_stat *stat) {
+	long offset;
+	while (next_entry(dir, &offset)) {
+		char *mmap = dir->image->mmap;
+
+		// Skip deleted entries, long file name pieces, the volume label, and the . and .. links
+		if (!is_named_entry(mmap, offset) || mmap[offset] == '.') {
+			continue;
+		}
+
+		fill_stat(dir->image, offset, stat);
+		return 1;
+	}
+
+	// Stay at the end from now on
+	dir->cluster = 0;
+	dir->index = dir->image->geometry.root_entries;
+	return 0;
+}
+
+void fat12_closedir(fat12_dir *dir) {
+	free(dir);
+}
+
+// Opens the file at path for reading. Returns NULL on an error (errno is set, EISDIR for a directory).
+fat12_file *fat12_open_file(fat12_image *image, const char *path) {
+	fat12_stat stat;
+	if (fat12_stat_path(image, path, &stat) < 0) {
+		return NULL;
+	}
+	if (stat.is_directory) {
+		errno = EISDIR;
+		return NULL;
+	}
+	return fat12_open_entry(image, stat.entry_offset);
+}
+
+// Opens the file whose directory entry is at entry_offset, for a caller that has found it some other way.
+// Returns NULL on an error (errno is EISDIR for a directory).
+fat12_file *fat12_open_entry(fat12_image *image, long entry_offset) {
+	fat12_stat stat;
+	fill_stat(image, entry_offset, &stat);
+	if (stat.is_directory) {
+		errno = EISDIR;
+		return NULL;
+	}
+
+	disk_geometry *geometry = &image->geometry;
+	int clusters_needed = (int) (((long) stat.size + geometry->bytes_per_cluster - 1) / geometry->bytes_per_cluster);
+	fat12_file *file = malloc(sizeof(fat12_file) + (clusters_needed * sizeof(int)));
+	file->image = image;
+	file->stat = stat;
+	file->position = 0;
+	file->num_clusters = 0;
+
+	// A chain that ends early just makes the file shorter
+	int cluster = stat.first_cluster;
+	while (file->num_clusters < clusters_needed && cluster >= 2 && cluster < geometry->total_clusters + 2) {
+		file->clusters[file->num_clusters ++] = cluster;
+		cluster = image->table->entries[cluster];
+	}
+	return file;
+}
+
+// Reads up to count bytes from offset without moving the file position. Safe to call from many threads on
+// one file. Returns the number of bytes read, 0 at the end of the file, or -1 (errno is EINVAL).
+ssize_t fat12_pread(fat12_file *file, void *buffer, size_t count, off_t offset) {
+	disk_geometry *geometry = &file->image->geometry;
+	long bytes_per_cluster = geometry->bytes_per_cluster;
+	long available = (long) file->num_clusters * bytes_per_cluster;
+	if (available > file->stat.size) {
+		available = file->stat.size;
+	}
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (offset >= available) {
+		return 0;
+	}
+	if ((long) count > available - offset) {
+		count = available - offset;
+	}
+
+	size_t done = 0;
+	while (done < count) {
+		int index = (offset + done) / bytes_per_cluster;
+		long within = (offset + done) % bytes_per_cluster;
+
+		// Take every following cluster that sits right after this one on disk in the same copy
+		int run_length = 1;
+		while (index + run_length < file->num_clusters && file->clusters[index + run_length] == file->clusters[index] + run_length
+			&& (long) run_length * bytes_per_cluster - within < (long) (count - done)) {
+			run_length ++;
+		}
+
+		size_t length = run_length * bytes_per_cluster - within;
+		if (length > count - done) {
+			length = count - done;
+		}
+		memcpy((char *) buffer + done, file->image->mmap + get_cluster_offset(geometry, file->clusters[index]) + within, length);
+		done += length;
+	}
+
+	return done;
+}
+
+// Reads up to count bytes from the file position and moves it on. Returns as fat12_pread does.
+ssize_t fat12_read(fat12_file *file, void *buffer, size_t count) {
+	ssize_t got = fat12_pread(file, buffer, count, file->position);
+	if (got > 0) {
+		file->position += got;
+	}
+	return got;
+}
+
+void fat12_close_file(fat12_file *file) {
+	free(file);
+}
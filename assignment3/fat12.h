@@ -0,0 +1,81 @@
+#ifndef FAT12_H_INCLUDED
+#define FAT12_H_INCLUDED
+
+// libfat12: read-only access to the files inside a FAT12 image, without running any of the tools.
+// diskinfo, disklist and diskget are built on it too.
+//
+// An image handle is never changed after fat12_open returns, so any number of threads can stat, list and read
+// through one handle at once. Directory and file handles belong to whoever opened them; fat12_pread is the
+// call to use when several threads read the same file.
+
+#include <sys/types.h> // ssize_t, off_t
+#include <time.h> // time_t
+#include "disk_layout.h"
+#include "fat_table.h"
+
+typedef struct {
+	int fd;
+	char *mmap;
+	long size;
+	disk_geometry geometry;
+	fat_table *table;
+} fat12_image;
+
+// What diskinfo reports
+typedef struct {
+	char os_name[9];
+	char disk_label[12];
+	long total_size;
+	long free_size;
+	int num_files_in_root;
+	int num_fat_copies;
+	int sectors_per_fat;
+} fat12_info;
+
+typedef struct {
+	char name[13];
+	int is_directory;
+	unsigned int size;
+	int first_cluster;
+	time_t created;
+	time_t modified;
+
+	// Where the directory entry is in the image, or 0 for the root directory
+	long entry_offset;
+} fat12_stat;
+
+typedef struct {
+	fat12_image *image;
+	int cluster;
+	int index;
+	int steps;
+} fat12_dir;
+
+typedef struct {
+	fat12_image *image;
+	fat12_stat stat;
+	long position;
+
+	// The chain laid out in order, so any offset finds its cluster in one step. It is in the same allocation.
+	int num_clusters;
+	int clusters[];
+} fat12_file;
+
+fat12_image *fat12_open(const char *path);
+void fat12_close(fat12_image *image);
+void fat12_attach(fat12_image *image, char *mmap);
+void fat12_detach(fat12_image *image);
+void fat12_statfs(fat12_image *image, fat12_info *info);
+int fat12_stat_path(fat12_image *image, const char *path, fat12_stat *stat);
+
+fat12_dir *fat12_opendir(fat12_image *image, const char *path);
+int fat12_readdir(fat12_dir *dir, fat12_stat *stat);
+void fat12_closedir(fat12_dir *dir);
+
+fat12_file *fat12_open_file(fat12_image *image, const char *path);
+fat12_file *fat12_open_entry(fat12_image *image, long entry_offset);
+ssize_t fat12_read(fat12_file *file, void *buffer, size_t count);
+ssize_t fat12_pread(fat12_file *file, void *buffer, size_t count, off_t offset);
+void fat12_close_file(fat12_file *file);
+
+#endif
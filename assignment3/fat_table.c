@@ -0,0 +1,193 @@
+// Decoded FAT12 table shared by the disk tools.
+//
+// FAT12 packs two 12 bit entries into every 3 bytes: for the pair (n, n + 1) starting at byte 3n/2,
+// entry n is the low 12 bits of the little endian 24 bit value and entry n + 1 is the high 12 bits.
+// Instead of picking entries out one at a time with a branch on the parity of n, the table is unpacked
+// in one pass, four entries per 6 bytes, and every tool then indexes the flat array.
+//
+// Alongside it sits a bitmap of the free data clusters, 64 to a word. The free space is a popcount per word,
+// and a run of free clusters is found a word at a time: all-used words are skipped whole, all-free words are
+// taken whole, and only mixed words are looked into, a run of bits at a time with count trailing zeros.
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+#include <endian.h> // le64toh
+#include "disk_layout.h"
+#include "fat_table.h"
+
+// Loads FAT copy 1 from the image. The table holds every entry the FAT has room for.
+fat_table *load_fat_table(char *mmap) {
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	int fat_size = geometry.sectors_per_fat * geometry.bytes_per_sector;
+
+	fat_table *table = malloc(sizeof(fat_table));
+	table->num_entries = (fat_size * 2) / 3;
+	table->entries = malloc(table->num_entries * sizeof(uint16_t));
+
+	// The first FAT starts right after the reserved sectors
+	unpack_fat_entries((unsigned char *) mmap + (geometry.first_fat_sector * geometry.bytes_per_sector), table->entries, table->num_entries);
+
+	// Only the data area, clusters 2 to total_clusters + 1, goes in the bitmap
+	int end = geometry.total_clusters + 2;
+	int i;
+	table->num_words = (end + 63) / 64;
+	table->free_bitmap = calloc(table->num_words, sizeof(uint64_t));
+	for (i = 2; i < end; i ++) {
+		if (table->entries[i] == 0x00) {
+			table->free_bitmap[i / 64] |= (uint64_t) 1 << (i % 64);
+		}
+	}
+	return table;
+}
+
+// Packs the table and copies it over every FAT copy in the image.
+void store_fat_table(fat_table *table, char *mmap) {
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	int fat_size = geometry.sectors_per_fat * geometry.bytes_per_sector;
+	char *first_fat = mmap + (geometry.first_fat_sector * geometry.bytes_per_sector);
+	int i;
+
+	// Pack into the first copy, then the rest are straight copies of it
+	pack_fat_entries(table->entries, (unsigned char *) first_fat, table->num_entries);
+	for (i = 1; i < geometry.total_fats; i ++) {
+		memcpy(first_fat + (i * fat_size), first_fat, fat_size);
+	}
+}
+
+void free_fat_table(fat_table *table) {
+	free(table->entries);
+	free(table->free_bitmap);
+	free(table);
+}
+
+void set_fat_entry(fat_table *table, int cluster, int value) {
+	uint64_t bit = (uint64_t) 1 << (cluster % 64);
+	table->entries[cluster] = value;
+	if (cluster >= 2 && cluster / 64 < table->num_words) {
+		if (value == 0x00) {
+			table->free_bitmap[cluster / 64] |= bit;
+		} else {
+			table->free_bitmap[cluster / 64] &= ~bit;
+		}
+	}
+}
+
+int count_free_clusters(fat_table *table) {
+	int free_clusters = 0;
+	int i;
+	for (i = 0; i < table->num_words; i ++) {
+		free_clusters += __builtin_popcountll(table->free_bitmap[i]);
+	}
+	return free_clusters;
+}
+
+// Returns the first cluster of the lowest run of at least length free clusters, or -1 if there is none.
+int find_free_run(fat_table *table, int length) {
+	int run_start = -1;
+	int run_length = 0;
+	int i;
+
+	if (length <= 0) {
+		return -1;
+	}
+
+	for (i = 0; i < table->num_words; i ++) {
+		uint64_t word = table->free_bitmap[i];
+		if (word == 0) {
+			run_length = 0;
+			continue;
+		}
+		if (word == ~(uint64_t) 0) {
+			if (run_length == 0) {
+				run_start = i * 64;
+			}
+			run_length += 64;
+			if (run_length >= length) {
+				return run_start;
+			}
+			continue;
+		}
+
+		int position = 0;
+		while (position < 64) {
+			uint64_t rest = word >> position;
+			if (rest == 0) {
+				run_length = 0;
+				break;
+			}
+
+			// Used clusters end the current run
+			int used = __builtin_ctzll(rest);
+			if (used > 0) {
+				run_length = 0;
+				position += used;
+				rest >>= used;
+			}
+
+			// The bits shifted in at the top are zero, so ~rest always has a set bit to stop at
+			int free_bits = __builtin_ctzll(~rest);
+			if (run_length == 0) {
+				run_start = i * 64 + position;
+			}
+			run_length += free_bits;
+			if (run_length >= length) {
+				return run_start;
+			}
+			position += free_bits;
+		}
+	}
+
+	return -1;
+}
+
+void unpack_fat_entries(const unsigned char *packed, uint16_t *entries, int num_entries) {
+	int i = 0;
+
+	// Four entries per 6 bytes, read as one unaligned 64 bit load. The load runs 2 bytes past the
+	// 6 it uses, so stop while there are still 2 more bytes of FAT behind it.
+	for (; i + 4 + 1 < num_entries; i += 4) {
+		uint64_t word;
+		memcpy(&word, packed + (i / 2) * 3, sizeof(word));
+		word = le64toh(word);
+
+		entries[i] = word & 0xFFF;
+		entries[i + 1] = (word >> 12) & 0xFFF;
+		entries[i + 2] = (word >> 24) & 0xFFF;
+		entries[i + 3] = (word >> 36) & 0xFFF;
+	}
+
+	// Whatever is left, one pair at a time
+	for (; i + 1 < num_entries; i += 2) {
+		const unsigned char *pair = packed + (i / 2) * 3;
+		uint32_t triple = pair[0] | (pair[1] << 8) | (pair[2] << 16);
+
+		entries[i] = triple & 0xFFF;
+		entries[i + 1] = triple >> 12;
+	}
+
+	if (i < num_entries) {
+		const unsigned char *pair = packed + (i / 2) * 3;
+		entries[i] = pair[0] | ((pair[1] & 0x0F) << 8);
+	}
+}
+
+void pack_fat_entries(const uint16_t *entries, unsigned char *packed, int num_entries) {
+	int i;
+	for (i = 0; i + 1 < num_entries; i += 2) {
+		unsigned char *pair = packed + (i / 2) * 3;
+		uint32_t triple = (entries[i] & 0xFFF) | ((uint32_t) (entries[i + 1] & 0xFFF) << 12);
+
+		pair[0] = triple & 0xFF;
+		pair[1] = (triple >> 8) & 0xFF;
+		pair[2] = (triple >> 16) & 0xFF;
+	}
+
+	// An odd entry count leaves the low half of a pair, whose high nibble belongs to no entry
+	if (i < num_entries) {
+		unsigned char *pair = packed + (i / 2) * 3;
+		pair[0] = entries[i] & 0xFF;
+		pair[1] = (pair[1] & 0xF0) | ((entries[i] >> 8) & 0x0F);
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef FAT_TABLE_H_INCLUDED
+#define FAT_TABLE_H_INCLUDED
+
+#include <stdint.h>
+
+// The whole FAT decoded once into one 16 bit slot per cluster. entries[n] is the FAT12 value of logical cluster n.
+// free_bitmap has bit n set while data cluster n is free; change entries through set_fat_entry to keep it current.
+typedef struct {
+	uint16_t *entries;
+	int num_entries;
+	uint64_t *free_bitmap;
+	int num_words;
+} fat_table;
+
+fat_table *load_fat_table(char *mmap);
+void store_fat_table(fat_table *table, char *mmap);
+void free_fat_table(fat_table *table);
+void set_fat_entry(fat_table *table, int cluster, int value);
+int count_free_clusters(fat_table *table);
+int find_free_run(fat_table *table, int length);
+void unpack_fat_entries(const unsigned char *packed, uint16_t *entries, int num_entries);
+void pack_fat_entries(const uint16_t *entries, unsigned char *packed, int num_entries);
+
+#endif
@@ -0,0 +1,135 @@
+// The copying half of diskget: the planned files are streamed out of the image on a pool of threads, each one
+// as iovecs pointing straight into the mapping.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h> // writev
+#include <limits.h> // IOV_MAX
+#include <errno.h>
+#include <pthread.h>
+#include "get_files.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static void *copy_worker_function(void *pointer) {
+	get_job *job = (get_job *) pointer;
+	int i;
+
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->num_plans) {
+		get_plan *plan = &job->plans[i];
+		if (copy_file_out(job->image, plan->entry_offset, plan->out_fd) < 0) {
+			plan->failed = 1;
+			perror(plan->file_name);
+		}
+	}
+
+	return (void *) 0;
+}
+
+// Streams every planned file out, with each worker taking the next file off a shared counter.
+void copy_files_out(fat12_image *image, get_plan *plans, int num_plans, int num_workers) {
+	get_job job;
+	job.image = image;
+	job.plans = plans;
+	job.num_plans = num_plans;
+	atomic_init(&job.next, 0);
+
+	if (num_workers > num_plans) {
+		num_workers = num_plans > 0 ? num_plans : 1;
+	}
+
+	// The calling thread is one of the workers
+	pthread_t *threads = malloc(num_workers * sizeof(pthread_t));
+	int i;
+	for (i = 1; i < num_workers; i ++) {
+		pthread_create(&threads[i], NULL, copy_worker_function, &job);
+	}
+	copy_worker_function(&job);
+	for (i = 1; i < num_workers; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+// Streams the file described by the directory entry at entry_offset into out_fd.
+// Returns 0 on success or -1 on an error (errno is set). A cluster chain that ends or leaves the data area before
+// the file size is reached is an error too (EUCLEAN), after writing out what the chain did hold.
+int copy_file_out(fat12_image *image, long entry_offset, int out_fd) {
+	fat12_file *file = fat12_open_entry(image, entry_offset);
+	if (file == NULL) {
+		return -1;
+	}
+
+	uint32_t bytes_per_cluster = image->geometry.bytes_per_cluster;
+	uint32_t remaining = file->stat.size;
+	struct iovec runs[IOV_MAX];
+	int num_runs = 0;
+	int result = 0;
+	int i = 0;
+
+	// The chain only holds clusters inside the data area, up to as many as the file size needs
+	while (i < file->num_clusters && result == 0) {
+		int run_start = file->clusters[i];
+		int run_length = 1;
+
+		// Merge every following cluster that sits right after this one on disk
+		while (i + run_length < file->num_clusters && file->clusters[i + run_length] == run_start + run_length) {
+			run_length ++;
+		}
+		i += run_length;
+
+		uint32_t run_bytes = run_length * bytes_per_cluster;
+		if (run_bytes > remaining) {
+			run_bytes = remaining;
+		}
+
+		runs[num_runs].iov_base = image->mmap + get_cluster_offset(&image->geometry, run_start);
+		runs[num_runs].iov_len = run_bytes;
+		num_runs ++;
+		remaining -= run_bytes;
+
+		if (num_runs == IOV_MAX) {
+			result = write_runs(out_fd, runs, num_runs);
+			num_runs = 0;
+		}
+	}
+
+	if (result == 0 && num_runs > 0) {
+		result = write_runs(out_fd, runs, num_runs);
+	}
+	fat12_close_file(file);
+	if (result == 0 && remaining > 0) {
+		errno = EUCLEAN;
+		result = -1;
+	}
+	return result;
+}
+
+// Writes every iovec in runs to fd, picking up where a short write left off.
+int write_runs(int fd, struct iovec *runs, int num_runs) {
+	while (num_runs > 0) {
+		ssize_t written = writev(fd, runs, num_runs);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		// Skip the iovecs that were written completely and trim the one that was written partially
+		while (num_runs > 0 && (size_t) written >= runs->iov_len) {
+			written -= runs->iov_len;
+			runs ++;
+			num_runs --;
+		}
+		if (num_runs > 0) {
+			runs->iov_base = (char *) runs->iov_base + written;
+			runs->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef GET_FILES_H_INCLUDED
+#define GET_FILES_H_INCLUDED
+
+#include <sys/uio.h> // struct iovec
+#include <stdatomic.h>
+#include "fat12.h"
+#include "dir_index.h"
+#include "batch.h"
+
+typedef struct {
+	char *file_name;
+	long entry_offset;
+	int out_fd;
+	int failed;
+} get_plan;
+
+typedef struct {
+	fat12_image *image;
+	get_plan *plans;
+	int num_plans;
+	atomic_int next;
+} get_job;
+
+void copy_files_out(fat12_image *image, get_plan *plans, int num_plans, int num_workers);
+int copy_file_out(fat12_image *image, long entry_offset, int out_fd);
+int write_runs(int fd, struct iovec *runs, int num_runs);
+
+#endif
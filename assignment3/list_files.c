@@ -0,0 +1,129 @@
+// The listings disklist prints: the files in the root directory, or every file and directory in the tree with
+// its full path. Each comes back as one allocation of records and names.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> // strcpy, strcmp
+#include "list_files.h"
+
+// Lists the files in the root directory in one allocation: the records, then a 13 byte name for each of them.
+// fat12_statfs counts the files, which sizes the allocation before the directory is read.
+file_struct *get_files_in_root(fat12_image *image, int *num_files) {
+	fat12_info info;
+	fat12_statfs(image, &info);
+	int count = info.num_files_in_root;
+	
+	file_struct *root_files = malloc(count * (sizeof(file_struct) + 13));
+	char *names = (char *) (root_files + count);
+	int index = 0;
+	fat12_dir *root = fat12_opendir(image, "/");
+	fat12_stat stat;
+	while (index < count && fat12_readdir(root, &stat)) {
+		if (stat.is_directory) {
+			continue;
+		}
+		root_files[index].file_name = names + (index * 13);
+		strcpy(root_files[index].file_name, stat.name);
+		get_file_details(image->mmap, &root_files[index], stat.entry_offset);
+		index ++;
+	}
+	fat12_closedir(root);
+	
+	*num_files = index;
+	return root_files;
+}
+
+// Fills in everything but the name.
+void get_file_details(char *mmap, file_struct *file, int offset) {
+	get_file_type(mmap, file->file_type, offset);
+	file->file_size = get_file_size(mmap, offset);
+	get_file_creation_date(mmap, file->file_creation_date, offset);
+	get_file_creation_time(mmap, file->file_creation_time, offset);
+}
+
+static int compare_file_names(const void *a, const void *b) {
+	return strcmp(((file_struct *) a)->file_name, ((file_struct *) b)->file_name);
+}
+
+// Lists every file and directory on the disk, named by full path and sorted by it. Like the root listing, the
+// records and the paths they point at share one allocation, sized exactly by a first pass over the paths.
+file_struct *get_files_in_tree(fat12_image *image, char *image_name, FILE *warnings, int num_workers, int *num_files, int *num_skipped) {
+	char *mmap = image->mmap;
+	walk_entry *entries;
+	int num_entries = walk_directories(mmap, image->table, num_workers, &entries, num_skipped);
+	char path[WALK_PATH_MAX];
+	size_t names_size = 0;
+	int i;
+	
+	for (i = 0; i < num_entries; i ++) {
+		get_walk_path(mmap, entries, i, path);
+		names_size += strlen(path) + 1;
+	}
+	
+	file_struct *files = malloc((num_entries * sizeof(file_struct)) + names_size);
+	char *names = (char *) (files + num_entries);
+	for (i = 0; i < num_entries; i ++) {
+		get_walk_path(mmap, entries, i, path);
+		files[i].file_name = names;
+		strcpy(names, path);
+		names += strlen(path) + 1;
+		
+		get_file_details(mmap, &files[i], entries[i].entry_offset);
+	}
+	
+	// The walk finds entries in whatever order the workers happen to reach them
+	qsort(files, num_entries, sizeof(file_struct), compare_file_names);
+	
+	if (warnings != NULL) {
+		print_skipped_directories(warnings, mmap, entries, num_entries, *num_skipped, image_name);
+	}
+	free(entries);
+	*num_files = num_entries;
+	return files;
+}
+
+void get_file_type(char *mmap, char *file_type, int offset) {
+	int attributeValue = mmap[offset + 11];
+	
+	file_type[0] = 'F';
+	file_type[1] = '\0';
+	if ((attributeValue & 0x10) == 0x10) {
+		file_type[0] = 'D';
+	}
+}
+
+int get_file_size(char *mmap, int offset) {
+	return read_le32(&DIRECTORY_ENTRY(mmap, offset)->file_size);
+}
+
+void get_file_creation_date(char *mmap, char *file_creation_date, int offset) {
+	int date = read_le16(&DIRECTORY_ENTRY(mmap, offset)->creation_date);
+	
+	// day is the first five bits: 11111 binary = 31 decimal
+	int day = date & 31;
+	
+	// month is the middle 4 bits. Shift them right until they are the low order bits. 1111 binary = 15 decimal.
+	int month = (date >> 5) & 15;
+	
+	// year is the last 7 bits. Shift them right until they are the low order bits. 1111111 binary = 127
+	// Since the year is based at 1980, we must also add 1980 to it.
+	int year = ((date >> 9) & 127) + 1980;
+	
+	sprintf(file_creation_date, "%d-%02d-%02d", year, month, day);
+}
+
+void get_file_creation_time(char *mmap, char *file_creation_time, int offset) {
+	int time = read_le16(&DIRECTORY_ENTRY(mmap, offset)->creation_time);
+	
+	// seconds is the first five bits: 11111 binary = 31 decimal. They are counted in two second intervals so we must multiply by 2.
+	int seconds = (time & 31) * 2;
+	
+	// minutes is the middle 6 bits. Shift them right until they are the low order bits. 111111 binary = 63 decimal.
+	int minutes = (time >> 5) & 63;
+	
+	// hours is the last 5 bits. Shift them right until they are the low order bits. 11111 binary = 31
+	// Since the year is based at 1980, we must also add 1980 to it.
+	int hours = (time >> 11) & 31;
+	
+	sprintf(file_creation_time, "%02d:%02d:%02d", hours, minutes, seconds);
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef LIST_FILES_H_INCLUDED
+#define LIST_FILES_H_INCLUDED
+
+#include <stdio.h>
+#include "fat12.h"
+#include "dir_walk.h"
+
+// One line of the listing. The name lives in the same allocation as the records.
+typedef struct {
+	char file_type[2];
+	char file_creation_date[11];
+	char file_creation_time[9];
+	int file_size;
+	char *file_name;
+} file_struct;
+
+file_struct *get_files_in_root(fat12_image *image, int *num_files);
+void get_file_details(char *mmap, file_struct *file, int offset);
+file_struct *get_files_in_tree(fat12_image *image, char *image_name, FILE *warnings, int num_workers, int *num_files, int *num_skipped);
+void get_file_type(char *mmap, char *file_type, int offset);
+int get_file_size(char *mmap, int offset);
+void get_file_creation_date(char *mmap, char *file_creation_date, int offset);
+void get_file_creation_time(char *mmap, char *file_creation_date, int offset);
+
+#endif
\ No newline at end of file
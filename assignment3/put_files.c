@@ -0,0 +1,363 @@
+// The work behind diskput, apart from its options: planning the batch, copying the files in concurrently and
+// committing everything through the block cache. diskbench calls put_files directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>  // open
+#include <sys/stat.h> // fstat
+#include <string.h> // memcpy, memset
+#include <time.h> // localtime
+#include <errno.h>
+#include <pthread.h>
+#include "put_files.h"
+
+// Puts every file in file_names into the image at file_system_image. A file that can't be put is reported and
+// left out, and the rest are still put. Returns the number of files left out, or -1 if the image itself could
+// not be opened or written (reported on stderr).
+int put_files(char *file_system_image, char **file_names, int num_files, int journaled, int num_workers) {
+	// Changes go to a private copy of the image until they are committed
+	block_cache *cache = open_block_cache(file_system_image, journaled);
+	if (cache == NULL) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "%s: Not a FAT12 image\n", file_system_image);
+		} else {
+			perror("Error opening file system image");
+		}
+		return -1;
+	}
+	char *map = cache->mmap;
+
+	disk_geometry geometry;
+	get_disk_geometry(map, &geometry);
+	dir_index *index = build_root_index(map);
+	fat_table *table = load_fat_table(map);
+
+	// Every name check, directory entry and cluster is settled for the whole batch before any data is copied
+	put_plan *plans = calloc(num_files, sizeof(put_plan));
+	int num_plans = 0;
+	int num_failed = 0;
+	int i;
+	for (i = 0; i < num_files; i ++) {
+		plans[num_plans].file_name = file_names[i];
+		if (plan_put(map, index, table, &plans[num_plans], num_files > 1) == 0) {
+			num_plans ++;
+		} else {
+			num_failed ++;
+		}
+	}
+
+	copy_files_in(map, plans, num_plans, num_workers);
+
+	for (i = 0; i < num_plans; i ++) {
+		put_plan *plan = &plans[i];
+		int j;
+		if (plan->failed) {
+			num_failed ++;
+			// Hand the clusters back; the directory entry was never written
+			for (j = 0; j < plan->num_extents; j ++) {
+				int cluster;
+				for (cluster = plan->extents[j].start; cluster < plan->extents[j].start + plan->extents[j].length; cluster ++) {
+					set_fat_entry(table, cluster, 0x00);
+				}
+			}
+		} else {
+			for (j = 0; j < plan->num_extents; j ++) {
+				mark_dirty(cache, get_cluster_offset(&geometry, plan->extents[j].start), (long) plan->extents[j].length * geometry.bytes_per_cluster);
+			}
+			int first_cluster = plan->num_extents > 0 ? plan->extents[0].start : 0;
+			write_root_entry(map, plan->entry_offset, plan->short_name, first_cluster, plan->file_size, plan->modified);
+			mark_dirty(cache, plan->entry_offset, sizeof(directory_entry));
+		}
+		free(plan->extents);
+		close(plan->in_fd);
+	}
+
+	if (num_plans > 0) {
+		store_fat_table(table, map);
+		mark_dirty(cache, (long) geometry.first_fat_sector * geometry.bytes_per_sector, (long) geometry.total_fats * geometry.sectors_per_fat * geometry.bytes_per_sector);
+	}
+
+	// Data goes in before anything points at it, then the FATs and root directory, all in one flush
+	int result = num_failed;
+	if (commit_block_cache(cache) < 0) {
+		perror("Error writing file system image");
+		result = -1;
+	}
+
+	free(plans);
+	free_dir_index(index);
+	free_fat_table(table);
+	close_block_cache(cache);
+	return result;
+}
+
+
+// Prints message for the file being put, naming the file when there is more than one.
+static void report_put(put_plan *plan, int batch, char *message) {
+	if (batch) {
+		printf("%s: %s\n", plan->file_name, message);
+	} else {
+		printf("%s\n", message);
+	}
+}
+
+// Opens plan->file_name and reserves its directory entry and clusters in index and table.
+// Returns 0 if the file can be put, or -1 after reporting why not.
+int plan_put(char *mmap, dir_index *index, fat_table *table, put_plan *plan, int batch) {
+	struct stat in_stats;
+	if ((plan->in_fd = open(plan->file_name, O_RDONLY)) < 0 || fstat(plan->in_fd, &in_stats) < 0 || !S_ISREG(in_stats.st_mode)) {
+		report_put(plan, batch, "File not found");
+		if (plan->in_fd >= 0) {
+			close(plan->in_fd);
+		}
+		return -1;
+	}
+
+	if (make_short_name(plan->short_name, plan->file_name) < 0) {
+		report_put(plan, batch, "Not a valid 8.3 file name");
+		close(plan->in_fd);
+		return -1;
+	}
+	if (find_in_index(index, plan->short_name) != NULL) {
+		report_put(plan, batch, "File already exists");
+		close(plan->in_fd);
+		return -1;
+	}
+
+	// Anything bigger than the whole data area can't fit, and checking first keeps the size within 32 bits
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	if (in_stats.st_size > (off_t) geometry.total_clusters * geometry.bytes_per_cluster) {
+		report_put(plan, batch, "File is larger than the disk image");
+		close(plan->in_fd);
+		return -1;
+	}
+	plan->file_size = (uint32_t) in_stats.st_size;
+	plan->modified = in_stats.st_mtime;
+	int clusters_needed = (int) ((plan->file_size + (uint32_t) geometry.bytes_per_cluster - 1) / geometry.bytes_per_cluster);
+
+	// At worst every cluster is its own extent
+	plan->extents = malloc((clusters_needed + 1) * sizeof(extent));
+	plan->num_extents = allocate_extents(mmap, table, clusters_needed, plan->extents);
+	if (plan->num_extents < 0) {
+		report_put(plan, batch, "Not enough free space in the disk image");
+		free(plan->extents);
+		close(plan->in_fd);
+		return -1;
+	}
+
+	plan->entry_offset = take_free_entry(index);
+	if (plan->entry_offset < 0) {
+		report_put(plan, batch, "No free entries in the root directory");
+		free(plan->extents);
+		close(plan->in_fd);
+		return -1;
+	}
+
+	// Claim the clusters and the name now so the rest of the batch plans around them
+	link_extents(table, plan->extents, plan->num_extents);
+	add_to_index(index, plan->short_name, 0x00, plan->num_extents > 0 ? plan->extents[0].start : 0, plan->entry_offset);
+	plan->failed = 0;
+	return 0;
+}
+
+static void *copy_worker_function(void *pointer) {
+	put_job *job = (put_job *) pointer;
+	int i;
+
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->num_plans) {
+		put_plan *plan = &job->plans[i];
+		int result = copy_file_in(job->mmap, plan->in_fd, plan->extents, plan->num_extents, plan->file_size);
+		if (result == -2) {
+			plan->failed = 1;
+			fprintf(stderr, "%s: File got shorter while it was being copied\n", plan->file_name);
+		} else if (result < 0) {
+			plan->failed = 1;
+			perror(plan->file_name);
+		}
+	}
+
+	return (void *) 0;
+}
+
+// Copies every planned file into its clusters. The files' extents never overlap, so they are copied
+// concurrently with no locking; each worker takes the next file off a shared counter.
+void copy_files_in(char *mmap, put_plan *plans, int num_plans, int num_workers) {
+	put_job job;
+	job.mmap = mmap;
+	job.plans = plans;
+	job.num_plans = num_plans;
+	atomic_init(&job.next, 0);
+
+	if (num_workers > num_plans) {
+		num_workers = num_plans > 0 ? num_plans : 1;
+	}
+
+	// The calling thread is one of the workers
+	pthread_t *threads = malloc(num_workers * sizeof(pthread_t));
+	int i;
+	for (i = 1; i < num_workers; i ++) {
+		pthread_create(&threads[i], NULL, copy_worker_function, &job);
+	}
+	copy_worker_function(&job);
+	for (i = 1; i < num_workers; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+// Fills extents with free cluster runs that add up to clusters_needed, ordered by position on disk.
+// Returns the number of extents used, or -1 if the disk does not have enough free clusters.
+int allocate_extents(char *mmap, fat_table *table, int clusters_needed, extent *extents) {
+	if (clusters_needed == 0) {
+		return 0;
+	}
+
+	if (count_free_clusters(table) < clusters_needed) {
+		return -1;
+	}
+
+	// First fit: a single run that holds the whole file
+	int start = find_free_run(table, clusters_needed);
+	if (start >= 0) {
+		extents[0].start = start;
+		extents[0].length = clusters_needed;
+		return 1;
+	}
+
+	// Logical index of data area is 2 to total_clusters + 1. Collect every free run in one scan.
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	extent *free_runs = malloc((geometry.total_clusters / 2 + 1) * sizeof(extent));
+	int num_free_runs = 0;
+	int i;
+	for (i = 2; i < geometry.total_clusters + 2; i ++) {
+		if (table->entries[i] != 0x00) {
+			continue;
+		}
+
+		if (num_free_runs > 0 && free_runs[num_free_runs - 1].start + free_runs[num_free_runs - 1].length == i) {
+			free_runs[num_free_runs - 1].length ++;
+		} else {
+			free_runs[num_free_runs].start = i;
+			free_runs[num_free_runs].length = 1;
+			num_free_runs ++;
+		}
+	}
+
+	// Otherwise take the largest runs first so the file is split as few times as possible
+	int num_extents = 0;
+	while (clusters_needed > 0) {
+		int largest = 0;
+		for (i = 1; i < num_free_runs; i ++) {
+			if (free_runs[i].length > free_runs[largest].length) {
+				largest = i;
+			}
+		}
+
+		extents[num_extents] = free_runs[largest];
+		if (extents[num_extents].length > clusters_needed) {
+			extents[num_extents].length = clusters_needed;
+		}
+		clusters_needed -= extents[num_extents].length;
+		free_runs[largest].length = 0;
+		num_extents ++;
+	}
+	free(free_runs);
+
+	// Chain the extents in disk order so reads move forward through the image
+	for (i = 1; i < num_extents; i ++) {
+		extent current = extents[i];
+		int j = i - 1;
+		while (j >= 0 && extents[j].start > current.start) {
+			extents[j + 1] = extents[j];
+			j --;
+		}
+		extents[j + 1] = current;
+	}
+
+	return num_extents;
+}
+
+// Links the extents into one chain in the decoded FAT. The table is packed over the FAT copies on the disk
+// once the whole batch has been planned.
+void link_extents(fat_table *table, extent *extents, int num_extents) {
+	int i;
+	for (i = 0; i < num_extents; i ++) {
+		int cluster;
+		int last = extents[i].start + extents[i].length - 1;
+		for (cluster = extents[i].start; cluster < last; cluster ++) {
+			set_fat_entry(table, cluster, cluster + 1);
+		}
+
+		// The last cluster of an extent points at the next extent, or ends the chain
+		set_fat_entry(table, last, i + 1 < num_extents ? extents[i + 1].start : 0xFFF);
+	}
+}
+
+// Reads the file straight into its clusters in the mapping, one read per extent.
+// Returns 0 on success, -1 on a read error (errno is set) or -2 if the file ends before file_size bytes.
+int copy_file_in(char *mmap, int in_fd, extent *extents, int num_extents, uint32_t file_size) {
+	disk_geometry geometry;
+	get_disk_geometry(mmap, &geometry);
+	uint32_t bytes_per_cluster = geometry.bytes_per_cluster;
+	uint32_t remaining = file_size;
+	int i;
+	for (i = 0; i < num_extents; i ++) {
+		char *destination = mmap + get_cluster_offset(&geometry, extents[i].start);
+		uint32_t extent_bytes = extents[i].length * bytes_per_cluster;
+		uint32_t wanted = remaining < extent_bytes ? remaining : extent_bytes;
+		uint32_t done = 0;
+
+		while (done < wanted) {
+			ssize_t got = read(in_fd, destination + done, wanted - done);
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			if (got < 0) {
+				return -1;
+			}
+			if (got == 0) {
+				return -2;
+			}
+			done += got;
+		}
+
+		// Don't leave stale data in the slack at the end of the last cluster
+		memset(destination + wanted, 0, extent_bytes - wanted);
+		remaining -= wanted;
+	}
+
+	return 0;
+}
+
+void write_root_entry(char *mmap, long offset, char *short_name, int first_cluster, uint32_t file_size, time_t modified) {
+	struct tm *local = localtime(&modified);
+	int date;
+	int time;
+
+	// Dates are day (5 bits), month (4 bits), years since 1980 (7 bits). Times are seconds / 2 (5 bits), minutes (6 bits), hours (5 bits).
+	// Anything outside 1980 to 2107 is pinned to the nearest end of that range.
+	if (local == NULL || local->tm_year < 80) {
+		date = 1 + (1 << 5);
+		time = 0;
+	} else if (local->tm_year > 80 + 127) {
+		date = 31 + (12 << 5) + (127 << 9);
+		time = (58 / 2) + (59 << 5) + (23 << 11);
+	} else {
+		date = local->tm_mday + ((local->tm_mon + 1) << 5) + ((local->tm_year - 80) << 9);
+		time = (local->tm_sec / 2) + (local->tm_min << 5) + (local->tm_hour << 11);
+	}
+
+	directory_entry *entry = DIRECTORY_ENTRY(mmap, offset);
+	memset(entry, 0, sizeof(directory_entry));
+	memcpy(entry->name, short_name, 11);
+	write_le16(&entry->creation_time, time);
+	write_le16(&entry->creation_date, date);
+	write_le16(&entry->last_access_date, date);
+	write_le16(&entry->last_write_time, time);
+	write_le16(&entry->last_write_date, date);
+	write_le16(&entry->first_cluster, first_cluster);
+	write_le32(&entry->file_size, file_size);
+}
@@ -0,0 +1,45 @@
+#ifndef PUT_FILES_H_INCLUDED
+#define PUT_FILES_H_INCLUDED
+
+#include <time.h> // time_t
+#include <stdatomic.h>
+#include "disk_layout.h"
+#include "fat_table.h"
+#include "dir_index.h"
+#include "block_cache.h"
+#include "batch.h"
+
+typedef struct {
+	int start;
+	int length;
+} extent;
+
+// One file of a put, with everything decided for it before any data is copied
+typedef struct {
+	char *file_name;
+	int in_fd;
+	uint32_t file_size;
+	time_t modified;
+	char short_name[11];
+	long entry_offset;
+	extent *extents;
+	int num_extents;
+	int failed;
+} put_plan;
+
+typedef struct {
+	char *mmap;
+	put_plan *plans;
+	int num_plans;
+	atomic_int next;
+} put_job;
+
+int put_files(char *file_system_image, char **file_names, int num_files, int journaled, int num_workers);
+int allocate_extents(char *mmap, fat_table *table, int clusters_needed, extent *extents);
+int plan_put(char *mmap, dir_index *index, fat_table *table, put_plan *plan, int batch);
+void copy_files_in(char *mmap, put_plan *plans, int num_plans, int num_workers);
+void link_extents(fat_table *table, extent *extents, int num_extents);
+int copy_file_in(char *mmap, int in_fd, extent *extents, int num_extents, uint32_t file_size);
+void write_root_entry(char *mmap, long offset, char *short_name, int first_cluster, uint32_t file_size, time_t modified);
+
+#endif